@@ -0,0 +1,373 @@
+#ifndef _BOUNDEDCACHE_HPP_
+#define _BOUNDEDCACHE_HPP_
+
+#include "HashMap.hpp"
+#include <functional>
+#include <mutex>
+#define SHARD_HASH_MULTIPLIER 0x9E3779B97F4A7C15ULL
+#define SHARDS_PER_THREAD 4
+#define CACHE_BUDGET_ERROR "ERROR: a cache must hold at least one entry."
+
+/**
+ * Counters of a cache since it was created.
+ */
+struct CacheStats
+{
+  size_t hits;
+  size_t misses;
+  size_t evictions;
+  size_t entries;
+  size_t bytes;
+
+  double hit_rate () const
+  {
+    size_t lookups = hits + misses;
+    return lookups == 0 ? 0 : (double) hits / lookups;
+  }
+};
+
+/**
+ * A cache that holds at most a given number of entries, and optionally at
+ * most a given number of bytes as measured by a weigh function. When it is
+ * full, put evicts entries with the CLOCK policy: entries sit in a ring of
+ * slots, each with a reference bit set when the entry is read or written.
+ * A hand sweeps the ring, clearing set bits and evicting the first entry
+ * whose bit is clear, so recently used entries get a second chance at O(1)
+ * amortized cost and without reordering anything on hits.
+ * A HashMap maps each key to its slot. Like HashMap, it needs external
+ * synchronization, see ConcurrentBoundedCache.
+ */
+template<class KeyT, class ValueT>
+class BoundedCache
+{
+ public:
+  typedef std::function<size_t (const KeyT &, const ValueT &)> weigh_function;
+
+ private:
+  struct slot
+  {
+    KeyT key;
+    ValueT value;
+    size_t weight;
+    bool referenced;
+    bool used;
+  };
+
+  HashMap<KeyT, size_t> index;
+  vector<slot> slots;
+  vector<size_t> free_slots;
+  size_t hand;
+  size_t max_entries;
+  size_t max_bytes;
+  weigh_function weigh;
+  size_t bytes;
+  size_t hits;
+  size_t misses;
+  size_t evictions;
+
+  void release (size_t position)
+  {
+    slot &curr = slots[position];
+    index.try_erase (curr.key);
+    bytes -= curr.weight;
+    curr.used = false;
+    curr.key = KeyT ();
+    curr.value = ValueT ();
+    free_slots.push_back (position);
+  }
+
+  /**
+   * Evicts one entry with the CLOCK hand. Called only when the cache has
+   * entries.
+   */
+  void evict_one ()
+  {
+    while (true)
+    {
+      slot &curr = slots[hand];
+      size_t position = hand;
+      hand = (hand + 1) % slots.size ();
+      if (!curr.used)
+      {
+        continue;
+      }
+      if (curr.referenced)
+      {
+        curr.referenced = false;
+        continue;
+      }
+      release (position);
+      evictions++;
+      return;
+    }
+  }
+
+  /**
+   * @return A free slot, evicting an entry or growing the ring if needed.
+   */
+  size_t take_slot ()
+  {
+    if (free_slots.empty ())
+    {
+      if (slots.size () < max_entries)
+      {
+        slots.push_back (slot {KeyT (), ValueT (), 0, false, false});
+        return slots.size () - 1;
+      }
+      evict_one ();
+    }
+    size_t position = free_slots.back ();
+    free_slots.pop_back ();
+    return position;
+  }
+
+ public:
+  /**
+   * @param _max_entries - The most entries the cache holds.
+   * @param _max_bytes - The most bytes the cache holds, as measured by
+   * _weigh. Unbounded by default.
+   * @param _weigh - Measures an entry for the bytes budget.
+   */
+  explicit BoundedCache (size_t _max_entries, size_t _max_bytes = SIZE_MAX,
+                         weigh_function _weigh = nullptr):
+      hand (0), max_entries (_max_entries), max_bytes (_max_bytes),
+      weigh (_weigh), bytes (0), hits (0), misses (0), evictions (0)
+  {
+    if (max_entries == 0)
+    {
+      throw std::invalid_argument (CACHE_BUDGET_ERROR);
+    }
+  }
+
+  size_t size () const
+  { return index.size (); }
+
+  bool empty () const
+  { return index.empty (); }
+
+  size_t capacity () const
+  { return max_entries; }
+
+  /**
+   * Looks up a key and marks its entry as recently used.
+   * @return A pointer to the cached value, valid until the next put or
+   * erase, or nullptr on a miss.
+   */
+  const ValueT *get (const KeyT &key)
+  {
+    const size_t *position = index.find (key);
+    if (position == nullptr)
+    {
+      misses++;
+      return nullptr;
+    }
+    hits++;
+    slots[*position].referenced = true;
+    return &slots[*position].value;
+  }
+
+  /**
+   * Copies the cached value of a key to value, see get.
+   * @return Whether the key was cached.
+   */
+  bool get (const KeyT &key, ValueT &value)
+  {
+    const ValueT *found = get (key);
+    if (found == nullptr)
+    {
+      return false;
+    }
+    value = *found;
+    return true;
+  }
+
+  /**
+   * Caches a value, evicting entries while the cache is over its budgets.
+   * An entry heavier than the whole bytes budget isn't cached, and leaves
+   * the value cached for its key, if any, in place.
+   * @return Whether the value was cached.
+   */
+  bool put (const KeyT &key, const ValueT &value)
+  {
+    size_t weight = weigh ? weigh (key, value) : 0;
+    if (weight > max_bytes)
+    {
+      return false;
+    }
+    size_t *position = index.find (key);
+    if (position != nullptr)
+    {
+      release (*position);
+    }
+    while (!empty () && bytes + weight > max_bytes)
+    {
+      evict_one ();
+    }
+    size_t curr = take_slot ();
+    slots[curr] = slot {key, value, weight, true, true};
+    bytes += weight;
+    index.insert (key, curr);
+    return true;
+  }
+
+  /**
+   * @return Whether the key was cached.
+   */
+  bool erase (const KeyT &key)
+  {
+    const size_t *position = index.find (key);
+    if (position == nullptr)
+    {
+      return false;
+    }
+    release (*position);
+    return true;
+  }
+
+  void clear ()
+  {
+    index.clear ();
+    slots.clear ();
+    free_slots.clear ();
+    hand = 0;
+    bytes = 0;
+  }
+
+  CacheStats stats () const
+  {
+    return CacheStats {hits, misses, evictions, size (), bytes};
+  }
+};
+
+/**
+ * A BoundedCache split into shards, each with its own lock, for caches
+ * shared by many threads. A key belongs to one shard, chosen by a mix of
+ * its hash, and the budgets are split as evenly as they divide between the
+ * shards, so eviction is per shard.
+ */
+template<class KeyT, class ValueT>
+class ConcurrentBoundedCache
+{
+  typedef BoundedCache<KeyT, ValueT> shard_type;
+
+  struct shard
+  {
+    std::mutex lock;
+    shard_type cache;
+
+    shard (size_t max_entries, size_t max_bytes,
+           typename shard_type::weigh_function weigh):
+        cache (max_entries, max_bytes, weigh)
+    {}
+  };
+
+  vector<std::unique_ptr<shard>> shards;
+
+  shard &shard_of (const KeyT &key) const
+  {
+    uint64_t mixed = (uint64_t) hash<KeyT> {} (key) * SHARD_HASH_MULTIPLIER;
+    return *shards[(mixed >> 32) % shards.size ()];
+  }
+
+ public:
+  /**
+   * @param max_entries - The most entries the cache holds.
+   * @param shard_count - The number of shards, SHARDS_PER_THREAD per
+   * hardware thread by default.
+   * @param max_bytes - The most bytes the cache holds, see BoundedCache.
+   * @param weigh - Measures an entry for the bytes budget.
+   */
+  explicit ConcurrentBoundedCache (size_t max_entries, size_t shard_count = 0,
+                                   size_t max_bytes = SIZE_MAX,
+                                   typename shard_type::weigh_function
+                                   weigh = nullptr)
+  {
+    if (shard_count == 0)
+    {
+      shard_count = SHARDS_PER_THREAD
+                    * std::max (1U, std::thread::hardware_concurrency ());
+    }
+    shard_count = std::max ((size_t) 1, std::min (shard_count, max_entries));
+    //The first shards take the remainders, so the shard budgets add up to
+    //the budgets asked for.
+    for (size_t i = 0; i < shard_count; i++)
+    {
+      size_t entries = max_entries / shard_count
+                       + (i < max_entries % shard_count ? 1 : 0);
+      size_t bytes = max_bytes == SIZE_MAX ? SIZE_MAX
+                     : max_bytes / shard_count
+                       + (i < max_bytes % shard_count ? 1 : 0);
+      shards.emplace_back (new shard (std::max ((size_t) 1, entries), bytes,
+                                      weigh));
+    }
+  }
+
+  size_t shard_count () const
+  { return shards.size (); }
+
+  size_t size () const
+  {
+    size_t total = 0;
+    for (const auto &curr : shards)
+    {
+      std::lock_guard<std::mutex> guard (curr->lock);
+      total += curr->cache.size ();
+    }
+    return total;
+  }
+
+  /**
+   * Copies the cached value of a key to value.
+   * @return Whether the key was cached.
+   */
+  bool get (const KeyT &key, ValueT &value)
+  {
+    shard &curr = shard_of (key);
+    std::lock_guard<std::mutex> guard (curr.lock);
+    return curr.cache.get (key, value);
+  }
+
+  bool put (const KeyT &key, const ValueT &value)
+  {
+    shard &curr = shard_of (key);
+    std::lock_guard<std::mutex> guard (curr.lock);
+    return curr.cache.put (key, value);
+  }
+
+  bool erase (const KeyT &key)
+  {
+    shard &curr = shard_of (key);
+    std::lock_guard<std::mutex> guard (curr.lock);
+    return curr.cache.erase (key);
+  }
+
+  void clear ()
+  {
+    for (auto &curr : shards)
+    {
+      std::lock_guard<std::mutex> guard (curr->lock);
+      curr->cache.clear ();
+    }
+  }
+
+  /**
+   * @return The counters of all the shards added up.
+   */
+  CacheStats stats () const
+  {
+    CacheStats total {0, 0, 0, 0, 0};
+    for (const auto &curr : shards)
+    {
+      std::lock_guard<std::mutex> guard (curr->lock);
+      CacheStats part = curr->cache.stats ();
+      total.hits += part.hits;
+      total.misses += part.misses;
+      total.evictions += part.evictions;
+      total.entries += part.entries;
+      total.bytes += part.bytes;
+    }
+    return total;
+  }
+};
+
+#endif //_BOUNDEDCACHE_HPP_
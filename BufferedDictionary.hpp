@@ -0,0 +1,312 @@
+#ifndef _BUFFEREDDICTIONARY_HPP_
+#define _BUFFEREDDICTIONARY_HPP_
+
+#include "Dictionary.hpp"
+#include <chrono>
+#include <mutex>
+#include <shared_mutex>
+#define BUFFER_MAX_KEYS 4096
+#define BUFFER_MAX_DELAY_MS 10
+
+/**
+ * When a BufferedDictionary::write_buffer merges its writes.
+ */
+struct BufferPolicy
+{
+  //Flush once the buffer holds this many keys.
+  size_t max_keys = BUFFER_MAX_KEYS;
+  //Flush on the first write this long after the last flush.
+  std::chrono::milliseconds max_delay =
+      std::chrono::milliseconds (BUFFER_MAX_DELAY_MS);
+};
+
+/**
+ * A Dictionary shared by many threads, written mostly through per-thread
+ * write buffers. A write_buffer collects one thread's assignments in a
+ * private HashMap and merges them into the shared dictionary in batches,
+ * taking the lock once per batch instead of once per write. The batch is
+ * hashed before the lock is taken and sorted by destination bucket, so
+ * the merge visits each bucket once and grows the dictionary at most once,
+ * for the keys that are new.
+ * Readers see a thread's writes once its buffer is flushed; the thread
+ * itself sees them at once through its buffer.
+ */
+class BufferedDictionary
+{
+  /**
+   * The shared dictionary, with the assignment a merge needs.
+   */
+  class shared_dictionary: public Dictionary
+  {
+   public:
+    bool holds (const std::string &key, size_t full_hash) const
+    { return find_item (key, full_hash) != nullptr; }
+
+    /**
+     * Assigns a value to a key whose hash is known, growing the map if the
+     * key is new and doesn't fit; call finish_batch afterwards.
+     */
+    void assign (const std::string &key, const std::string &value,
+                 size_t full_hash)
+    {
+      const auto *found = find_item (key, full_hash);
+      if (found != nullptr)
+      {
+        const_cast<std::string &> (found->second) = value;
+        return;
+      }
+      reserve (map_size + 1);
+      allocate_table ();
+      (hash_table + index_of (full_hash))->emplace_back (key, value,
+                                                         full_hash);
+      map_size++;
+    }
+
+    void finish_batch ()
+    { update_load_factor (); }
+  };
+
+  struct hashed_write
+  {
+    size_t full_hash;
+    const pair<std::string, std::string> *write;
+  };
+
+  shared_dictionary shared;
+  mutable std::shared_timed_mutex lock;
+
+ public:
+  /**
+   * The write buffer of one thread, to be used by that thread only.
+   * Destroying it flushes it.
+   */
+  class write_buffer
+  {
+    BufferedDictionary &target;
+    BufferPolicy policy;
+    HashMap<std::string, std::string> pending;
+    std::chrono::steady_clock::time_point last_flush;
+
+    void flush_if_full ()
+    {
+      if (pending.size () >= policy.max_keys)
+      {
+        flush ();
+      }
+      else
+      {
+        flush_if_due ();
+      }
+    }
+
+   public:
+    explicit write_buffer (BufferedDictionary &_target,
+                           BufferPolicy _policy = BufferPolicy ()):
+        target (_target), policy (_policy),
+        last_flush (std::chrono::steady_clock::now ())
+    {
+      pending.reserve (policy.max_keys);
+    }
+
+    write_buffer (const write_buffer &) = delete;
+    write_buffer &operator= (const write_buffer &) = delete;
+
+    ~write_buffer ()
+    {
+      flush ();
+    }
+
+    /**
+     * @return The number of keys waiting to be merged.
+     */
+    size_t pending_size () const
+    { return pending.size (); }
+
+    /**
+     * Sets the value of a key, inserting the key if needed. The last write
+     * to a key before a flush wins.
+     */
+    void set (const std::string &key, const std::string &value)
+    {
+      std::string *found = pending.find (key);
+      if (found != nullptr)
+      {
+        *found = value;
+      }
+      else
+      {
+        pending.insert (key, value);
+      }
+      flush_if_full ();
+    }
+
+    /**
+     * Erases a key from the shared dictionary right away, dropping its
+     * buffered write if any.
+     * @return Whether the key was in the shared dictionary or the buffer.
+     */
+    bool erase (const std::string &key)
+    {
+      bool buffered = pending.try_erase (key);
+      return target.erase (key) || buffered;
+    }
+
+    /**
+     * Copies the value of a key to value, from this buffer if the key was
+     * written since the last flush, else from the shared dictionary.
+     * @return Whether the key was found.
+     */
+    bool get (const std::string &key, std::string &value) const
+    {
+      const std::string *found = pending.find (key);
+      if (found != nullptr)
+      {
+        value = *found;
+        return true;
+      }
+      return target.get (key, value);
+    }
+
+    bool contains_key (const std::string &key) const
+    {
+      return pending.contains_key (key) || target.contains_key (key);
+    }
+
+    /**
+     * Flushes the buffer if the policy's delay passed since the last
+     * flush, for threads that go quiet for a while.
+     */
+    void flush_if_due ()
+    {
+      if (std::chrono::steady_clock::now () - last_flush >= policy.max_delay)
+      {
+        flush ();
+      }
+    }
+
+    /**
+     * Merges the buffered writes into the shared dictionary.
+     */
+    void flush ()
+    {
+      if (!pending.empty ())
+      {
+        target.merge (pending);
+        pending.clear ();
+      }
+      last_flush = std::chrono::steady_clock::now ();
+    }
+  };
+
+  size_t size () const
+  {
+    std::shared_lock<std::shared_timed_mutex> guard (lock);
+    return shared.size ();
+  }
+
+  bool empty () const
+  { return size () == 0; }
+
+  /**
+   * Copies the value of a key to value.
+   * @return Whether the key is in the shared dictionary.
+   */
+  bool get (const std::string &key, std::string &value) const
+  {
+    std::shared_lock<std::shared_timed_mutex> guard (lock);
+    const std::string *found = shared.find (key);
+    if (found == nullptr)
+    {
+      return false;
+    }
+    value = *found;
+    return true;
+  }
+
+  bool contains_key (const std::string &key) const
+  {
+    std::shared_lock<std::shared_timed_mutex> guard (lock);
+    return shared.contains_key (key);
+  }
+
+  /**
+   * Sets the value of a key directly, without a buffer.
+   */
+  void set (const std::string &key, const std::string &value)
+  {
+    std::unique_lock<std::shared_timed_mutex> guard (lock);
+    shared[key] = value;
+  }
+
+  bool erase (const std::string &key)
+  {
+    std::unique_lock<std::shared_timed_mutex> guard (lock);
+    return shared.erase (key, std::nothrow);
+  }
+
+  /**
+   * Merges a batch of writes into the shared dictionary, later batches
+   * winning over earlier ones. The keys are hashed and their new ones
+   * counted before the exclusive lock is taken, with the shared lock held
+   * so readers go on, and sorted by bucket for the capacity the dictionary
+   * will have with the new keys. Under the exclusive lock the dictionary
+   * grows for those keys only, and the batch is sorted again only if
+   * another batch grew the dictionary meanwhile. Keys another batch made
+   * new in between grow it as they are assigned.
+   */
+  void merge (const HashMap<std::string, std::string> &writes)
+  {
+    vector<hashed_write> batch;
+    batch.reserve (writes.size ());
+    for (const auto &element : writes)
+    {
+      batch.push_back (hashed_write {hash<std::string> {} (element.first),
+                                     &element});
+    }
+    size_t new_keys = 0;
+    size_t expected_capacity;
+    {
+      std::shared_lock<std::shared_timed_mutex> guard (lock);
+      for (const auto &curr : batch)
+      {
+        new_keys += !shared.holds (curr.write->first, curr.full_hash);
+      }
+      //The capacity reserve will grow the dictionary to.
+      expected_capacity = shared.capacity ();
+      while ((double) (shared.size () + new_keys) / expected_capacity
+             > (double) UPPER_LOAD_FACTOR)
+      {
+        expected_capacity *= 2;
+      }
+    }
+    auto by_bucket = [] (size_t capacity)
+    {
+      return [capacity] (const hashed_write &lhs, const hashed_write &rhs)
+      { return (lhs.full_hash & (capacity - 1))
+               < (rhs.full_hash & (capacity - 1)); };
+    };
+    std::sort (batch.begin (), batch.end (), by_bucket (expected_capacity));
+    std::unique_lock<std::shared_timed_mutex> guard (lock);
+    shared.reserve (shared.size () + new_keys);
+    if (shared.capacity () != expected_capacity)
+    {
+      std::sort (batch.begin (), batch.end (), by_bucket (shared.capacity ()));
+    }
+    for (const auto &curr : batch)
+    {
+      shared.assign (curr.write->first, curr.write->second, curr.full_hash);
+    }
+    shared.finish_batch ();
+  }
+
+  /**
+   * @return A copy of the shared dictionary.
+   */
+  Dictionary snapshot () const
+  {
+    std::shared_lock<std::shared_timed_mutex> guard (lock);
+    return shared;
+  }
+};
+
+#endif //_BUFFEREDDICTIONARY_HPP_
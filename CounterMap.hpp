@@ -0,0 +1,213 @@
+#ifndef _COUNTERMAP_HPP_
+#define _COUNTERMAP_HPP_
+
+#include "StripedHashMap.hpp"
+#include <atomic>
+#include <functional>
+#include <queue>
+#define COUNTER_FLUSH_KEYS (1 << 14)
+
+/**
+ * A count that threads may add to at once. Copying it, which only happens
+ * while no other thread may touch it, reads and writes it atomically too.
+ */
+struct counter_cell
+{
+  mutable std::atomic<int64_t> count;
+
+  explicit counter_cell (int64_t initial = 0): count (initial)
+  {}
+
+  counter_cell (const counter_cell &other):
+      count (other.count.load (std::memory_order_relaxed))
+  {}
+
+  counter_cell &operator= (const counter_cell &other)
+  {
+    count.store (other.count.load (std::memory_order_relaxed),
+                 std::memory_order_relaxed);
+    return *this;
+  }
+
+  bool operator== (const counter_cell &other) const
+  { return count.load () == other.count.load (); }
+
+  bool operator!= (const counter_cell &other) const
+  { return !(*this == other); }
+};
+
+/**
+ * A map from keys to 64-bit counts, for counting frequencies from many
+ * threads, e.g. word counts. It is a StripedHashMap of atomic counts, so
+ * incrementing a key that is already counted takes one probe with the
+ * key's stripe locked shared, and threads incrementing the same hot key
+ * only contend on its atomic. Counting a new key locks its stripe
+ * exclusively. For keys that repeat heavily, local_buffer sums increments
+ * in a private map first and adds them in batches.
+ */
+template<class KeyT>
+class CounterMap
+{
+  StripedHashMap<KeyT, counter_cell> counts;
+
+ public:
+  typedef pair<KeyT, int64_t> key_count;
+
+  /**
+   * Sums the increments of one thread and adds them to a CounterMap in
+   * batches, when it holds flush_keys keys, on flush, and when it is
+   * destroyed. Counts it holds aren't seen by readers of the map yet.
+   */
+  class local_buffer
+  {
+    CounterMap &target;
+    HashMap<KeyT, int64_t> pending;
+    size_t flush_keys;
+
+   public:
+    explicit local_buffer (CounterMap &_target,
+                           size_t _flush_keys = COUNTER_FLUSH_KEYS):
+        target (_target), flush_keys (_flush_keys)
+    {
+      pending.reserve (flush_keys);
+    }
+
+    local_buffer (const local_buffer &) = delete;
+    local_buffer &operator= (const local_buffer &) = delete;
+
+    ~local_buffer ()
+    {
+      flush ();
+    }
+
+    void increment (const KeyT &key, int64_t delta = 1)
+    {
+      int64_t *found = pending.find (key);
+      if (found != nullptr)
+      {
+        *found += delta;
+        return;
+      }
+      pending.insert (key, delta);
+      if (pending.size () >= flush_keys)
+      {
+        flush ();
+      }
+    }
+
+    /**
+     * Adds the buffered counts to the map.
+     */
+    void flush ()
+    {
+      for (const auto &element : pending)
+      {
+        target.increment (element.first, element.second);
+      }
+      pending.clear ();
+    }
+  };
+
+  explicit CounterMap (size_t stripe_count = LOCK_STRIPES):
+      counts (stripe_count)
+  {}
+
+  /**
+   * @return The number of keys counted.
+   */
+  size_t size () const
+  { return counts.size (); }
+
+  bool empty () const
+  { return counts.empty (); }
+
+  /**
+   * Adds delta to the count of a key, counting it from 0 if it is new.
+   * @return The count after the addition.
+   */
+  int64_t increment (const KeyT &key, int64_t delta = 1)
+  {
+    int64_t before = 0;
+    auto add = [delta, &before] (const counter_cell &cell)
+    { before = cell.count.fetch_add (delta, std::memory_order_relaxed); };
+    while (!counts.visit_if_present (key, add))
+    {
+      if (counts.insert (key, counter_cell (delta)))
+      {
+        return delta;
+      }
+    }
+    return before + delta;
+  }
+
+  /**
+   * @return The count of a key, 0 if it wasn't counted.
+   */
+  int64_t get (const KeyT &key) const
+  {
+    int64_t result = 0;
+    counts.visit_if_present (key, [&result] (const counter_cell &cell)
+    { result = cell.count.load (std::memory_order_relaxed); });
+    return result;
+  }
+
+  /**
+   * @return Whether the key was counted.
+   */
+  bool erase (const KeyT &key)
+  { return counts.erase (key); }
+
+  void clear ()
+  { counts.clear (); }
+
+  /**
+   * @return The n keys with the highest counts, highest first, found in
+   * one pass with a heap of n entries. Ties are broken arbitrarily.
+   */
+  vector<key_count> top_k (size_t n) const
+  {
+    auto higher = [] (const key_count &lhs, const key_count &rhs)
+    { return lhs.second > rhs.second; };
+    //A min-heap of the best n so far, its top the one to replace.
+    std::priority_queue<key_count, vector<key_count>, decltype (higher)>
+        best (higher);
+    if (n == 0)
+    {
+      return vector<key_count> ();
+    }
+    counts.for_each ([&best, n] (const KeyT &key, const counter_cell &cell)
+    {
+      int64_t count = cell.count.load (std::memory_order_relaxed);
+      if (best.size () < n)
+      {
+        best.emplace (key, count);
+      }
+      else if (count > best.top ().second)
+      {
+        best.pop ();
+        best.emplace (key, count);
+      }
+    });
+    vector<key_count> result (best.size ());
+    for (size_t i = result.size (); i > 0; i--)
+    {
+      result[i - 1] = best.top ();
+      best.pop ();
+    }
+    return result;
+  }
+
+  /**
+   * @return A copy of the counts.
+   */
+  HashMap<KeyT, int64_t> snapshot () const
+  {
+    HashMap<KeyT, int64_t> copy;
+    copy.reserve (size ());
+    counts.for_each ([&copy] (const KeyT &key, const counter_cell &cell)
+    { copy.insert (key, cell.count.load (std::memory_order_relaxed)); });
+    return copy;
+  }
+};
+
+#endif //_COUNTERMAP_HPP_
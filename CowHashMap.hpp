@@ -0,0 +1,576 @@
+#ifndef _COWHASHMAP_HPP_
+#define _COWHASHMAP_HPP_
+
+#include "HashMap.hpp"
+#include "Dictionary.hpp"
+#include <atomic>
+#include <memory>
+#define COW_PAGE_BITS 6
+#define COW_PAGE_SIZE (1 << COW_PAGE_BITS)
+
+/**
+ * A hash-map with the HashMap interface whose storage is shared
+ * copy-on-write between the map, its copies and its snapshots.
+ * The buckets are reference counted and grouped into pages of
+ * COW_PAGE_SIZE buckets, which are in turn held by a shared directory.
+ * Taking a snapshot or copying the map only shares the directory, and a
+ * writer copies the directory, the page and the bucket it touches the first
+ * time it modifies them while they are shared.
+ * Snapshots may be read from other threads while the owner keeps writing to
+ * the map, as long as a single thread writes to the map itself.
+ */
+template<class KeyT, class ValueT>
+class CowHashMap
+{
+  //Typedefs to simplify the code.
+  typedef pair<KeyT,ValueT> item;
+  typedef vector<item> bucket;
+  typedef std::shared_ptr<bucket> bucket_ptr;
+
+  struct page
+  {
+    bucket_ptr buckets[COW_PAGE_SIZE];
+  };
+
+  typedef std::shared_ptr<page> page_ptr;
+  typedef vector<page_ptr> directory;
+  typedef std::shared_ptr<directory> directory_ptr;
+
+  //Map fields
+  directory_ptr table;
+  size_t map_size;
+  double load_factor;
+  size_t map_capacity;
+
+  /**
+   * @return whether the pointer is the only owner of its object. The fence
+   * orders our following writes after the reads made by the owners that
+   * already released it.
+   */
+  template<class PtrT>
+  static bool is_unique (const PtrT &ptr)
+  {
+    if (ptr.use_count () == 1)
+    {
+      std::atomic_thread_fence (std::memory_order_acquire);
+      return true;
+    }
+    return false;
+  }
+
+  static size_t page_count (size_t capacity)
+  {
+    return (capacity + COW_PAGE_SIZE - 1) / COW_PAGE_SIZE;
+  }
+
+  /**
+   * @return The bucket at the given index, or nullptr if it is empty.
+   */
+  static const bucket *find_bucket (const directory *dir, size_t index)
+  {
+    if (dir == nullptr)
+    {
+      return nullptr;
+    }
+    const page_ptr &curr_page = (*dir)[index >> COW_PAGE_BITS];
+    if (!curr_page)
+    {
+      return nullptr;
+    }
+    return curr_page->buckets[index & (COW_PAGE_SIZE - 1)].get ();
+  }
+
+  static const item *find_item (const directory *dir, size_t capacity,
+                                const KeyT &key)
+  {
+    size_t hash_value = hash<KeyT> {} (key) & (capacity - 1);
+    const bucket *curr_bucket = find_bucket (dir, hash_value);
+    if (curr_bucket == nullptr)
+    {
+      return nullptr;
+    }
+    for (const auto &element : *curr_bucket)
+    {
+      if (element.first == key)
+      {
+        return &element;
+      }
+    }
+    return nullptr;
+  }
+
+  size_t hash_func (const KeyT &key) const
+  {
+    return hash<KeyT> {} (key) & (map_capacity - 1);
+  }
+
+  void update_load_factor ()
+  {
+    load_factor = (double) size () / capacity ();
+  }
+
+  /**
+   * Returns a bucket the map may modify, copying the directory, the page
+   * and the bucket on the way if any of them is shared.
+   * @param index - The index of the bucket in the map.
+   */
+  bucket &writable_bucket (size_t index)
+  {
+    if (!table)
+    {
+      table = std::make_shared<directory> (page_count (map_capacity));
+    }
+    else if (!is_unique (table))
+    {
+      table = std::make_shared<directory> (*table);
+    }
+    page_ptr &curr_page = (*table)[index >> COW_PAGE_BITS];
+    if (!curr_page)
+    {
+      curr_page = std::make_shared<page> ();
+    }
+    else if (!is_unique (curr_page))
+    {
+      curr_page = std::make_shared<page> (*curr_page);
+    }
+    bucket_ptr &curr_bucket = curr_page->buckets[index & (COW_PAGE_SIZE - 1)];
+    if (!curr_bucket)
+    {
+      curr_bucket = std::make_shared<bucket> ();
+    }
+    else if (!is_unique (curr_bucket))
+    {
+      curr_bucket = std::make_shared<bucket> (*curr_bucket);
+    }
+    return *curr_bucket;
+  }
+
+  /**
+   * Rebuilds the map with a new capacity. Items of buckets that aren't
+   * shared with a snapshot are moved, the others are copied.
+   * @param new_capacity - The capacity of the rebuilt map.
+   */
+  void rehash_func (size_t new_capacity)
+  {
+    directory_ptr old_table = std::move (table);
+    size_t old_capacity = map_capacity;
+    map_capacity = new_capacity;
+    bool table_unique = old_table && is_unique (old_table);
+    for (size_t i = 0; old_table && i < page_count (old_capacity); i++)
+    {
+      page_ptr &curr_page = (*old_table)[i];
+      if (!curr_page)
+      {
+        continue;
+      }
+      bool page_unique = table_unique && is_unique (curr_page);
+      for (int j = 0; j < COW_PAGE_SIZE; j++)
+      {
+        bucket_ptr &curr_bucket = curr_page->buckets[j];
+        if (!curr_bucket)
+        {
+          continue;
+        }
+        bool movable = page_unique && is_unique (curr_bucket);
+        for (auto &element : *curr_bucket)
+        {
+          bucket &target = writable_bucket (hash_func (element.first));
+          if (movable)
+          {
+            target.push_back (std::move (element));
+          }
+          else
+          {
+            target.push_back (element);
+          }
+        }
+      }
+    }
+    update_load_factor ();
+  }
+
+ public:
+  class ConstIterator
+  {
+    friend class CowHashMap;
+
+   public:
+    typedef pair<KeyT, ValueT> value_type;
+    typedef const value_type &reference;
+    typedef const value_type *pointer;
+    typedef std::ptrdiff_t difference_type;
+    typedef std::forward_iterator_tag iterator_category;
+
+   private:
+    const directory *table;
+    size_t capacity;
+    size_t outer_index;
+    size_t inner_index;
+
+    const bucket *curr_bucket () const
+    {
+      return find_bucket (table, outer_index);
+    }
+
+    //Moves to the first non-empty bucket starting from outer_index.
+    void skip_empty ()
+    {
+      while (outer_index < capacity)
+      {
+        const bucket *b = curr_bucket ();
+        if (b != nullptr && !b->empty ())
+        {
+          return;
+        }
+        outer_index++;
+      }
+    }
+
+   public:
+    ConstIterator (const directory *_table, size_t _capacity,
+                   size_t _outer_index):
+        table (_table), capacity (_capacity), outer_index (_outer_index),
+        inner_index (0)
+    {
+      skip_empty ();
+    }
+
+    ConstIterator &operator++ ()
+    {
+      inner_index++;
+      if (inner_index >= curr_bucket ()->size ())
+      {
+        outer_index++;
+        inner_index = 0;
+        skip_empty ();
+      }
+      return *this;
+    }
+
+    ConstIterator operator++ (int)
+    {
+      ConstIterator it (*this);
+      this->operator++ ();
+      return it;
+    }
+
+    bool operator== (const ConstIterator &rhs) const
+    {
+      return table == rhs.table && outer_index == rhs.outer_index
+             && inner_index == rhs.inner_index;
+    }
+
+    bool operator!= (const ConstIterator &rhs) const
+    {
+      return !(operator== (rhs));
+    }
+
+    reference operator* () const
+    {
+      return (*curr_bucket ())[inner_index];
+    }
+
+    pointer operator-> () const
+    {
+      return &(operator* ());
+    }
+  };
+
+  using const_iterator = ConstIterator;
+
+  /**
+   * An immutable, consistent view of the map at the moment it was taken.
+   * Later writes to the map are not visible through it.
+   */
+  class Snapshot
+  {
+    friend class CowHashMap;
+
+    std::shared_ptr<const directory> table;
+    size_t map_size;
+    size_t map_capacity;
+
+    Snapshot (std::shared_ptr<const directory> _table, size_t _size,
+              size_t _capacity):
+        table (std::move (_table)), map_size (_size), map_capacity (_capacity)
+    {}
+
+   public:
+    size_t size () const
+    { return map_size; }
+
+    size_t capacity () const
+    { return map_capacity; }
+
+    bool empty () const
+    { return (map_size == 0); }
+
+    bool contains_key (const KeyT &key) const
+    {
+      return find_item (table.get (), map_capacity, key) != nullptr;
+    }
+
+    const ValueT &at (const KeyT &key) const
+    {
+      const item *found = find_item (table.get (), map_capacity, key);
+      if (found == nullptr)
+      {
+        throw std::runtime_error (INVALID_KEY_ERROR);
+      }
+      return found->second;
+    }
+
+    const_iterator begin () const
+    {
+      return const_iterator (table.get (), map_capacity, 0);
+    }
+
+    const_iterator end () const
+    {
+      return const_iterator (table.get (), map_capacity, map_capacity);
+    }
+  };
+
+  //Default Constructor
+  CowHashMap ():
+      table (nullptr),
+      map_size (EMPTY_HASH),
+      load_factor (EMPTY_HASH),
+      map_capacity (STARTING_HASH_CAPACITY)
+  {}
+
+  /**
+   * Constructs a hash-table from a vectors of keys and a vectors of values.
+   * @param key_vect
+   * @param value_vect
+   */
+  CowHashMap (const vector<KeyT> &key_vect, const vector<ValueT> &value_vect):
+      CowHashMap ()
+  {
+    if (key_vect.size () != value_vect.size ())
+    {
+      throw std::length_error (CONSTRUCTOR_ERROR);
+    }
+    for (size_t i = 0; i < key_vect.size (); i++)
+    {
+      operator[] (key_vect[i]) = value_vect[i];
+    }
+  }
+
+  //Copies share the storage until one of them writes to it.
+  CowHashMap (const CowHashMap &other) = default;
+  CowHashMap &operator= (const CowHashMap &rhs) = default;
+
+  virtual ~CowHashMap () = default;
+
+  size_t size () const
+  { return map_size; }
+
+  size_t capacity () const
+  { return map_capacity; }
+
+  bool empty () const
+  { return (map_size == 0); }
+
+  double get_load_factor () const
+  { return load_factor; }
+
+  /**
+   * Takes a consistent read-only view of the map in O(1).
+   */
+  Snapshot snapshot () const
+  {
+    return Snapshot (table, map_size, map_capacity);
+  }
+
+  bool contains_key (const KeyT &key) const
+  {
+    return find_item (table.get (), map_capacity, key) != nullptr;
+  }
+
+  const ValueT &at (const KeyT &key) const
+  {
+    const item *found = find_item (table.get (), map_capacity, key);
+    if (found == nullptr)
+    {
+      throw std::runtime_error (INVALID_KEY_ERROR);
+    }
+    return found->second;
+  }
+
+  /**
+   * @return A modifiable reference to the value of the key. Detaches the
+   * bucket of the key from any snapshot that shares it.
+   */
+  ValueT &at (const KeyT &key)
+  {
+    if (!contains_key (key))
+    {
+      throw std::runtime_error (INVALID_KEY_ERROR);
+    }
+    for (auto &element : writable_bucket (hash_func (key)))
+    {
+      if (element.first == key)
+      {
+        return element.second;
+      }
+    }
+    throw std::runtime_error (INVALID_KEY_ERROR);
+  }
+
+  bool insert (const KeyT &key, const ValueT &value)
+  {
+    if (contains_key (key))
+    {
+      return false;
+    }
+    writable_bucket (hash_func (key)).emplace_back (key, value);
+    map_size++;
+    update_load_factor ();
+    if (load_factor > (double) UPPER_LOAD_FACTOR)
+    {
+      rehash_func (map_capacity * 2);
+    }
+    return true;
+  }
+
+  virtual bool erase (const KeyT &key)
+  {
+    if (!contains_key (key))
+    {
+      return false;
+    }
+    bucket &curr_bucket = writable_bucket (hash_func (key));
+    auto it = std::find_if (curr_bucket.begin (), curr_bucket.end (),
+                            [&key] (const item &element)
+                            { return element.first == key; });
+    curr_bucket.erase (it);
+    map_size--;
+    update_load_factor ();
+    if (load_factor < (double) LOWER_LOAD_FACTOR)
+    {
+      size_t new_capacity = map_capacity;
+      if (map_size == EMPTY_HASH)
+      {
+        new_capacity = MINIMUM_VALID_CAPACITY;
+      }
+      while (new_capacity > MINIMUM_VALID_CAPACITY
+             && (double) map_size / new_capacity < (double) LOWER_LOAD_FACTOR)
+      {
+        new_capacity /= 2;
+      }
+      rehash_func (new_capacity);
+    }
+    return true;
+  }
+
+  /**
+   * Removes all the items but doesn't change the capacity. Snapshots keep
+   * their items.
+   */
+  void clear ()
+  {
+    table.reset ();
+    map_size = EMPTY_HASH;
+    update_load_factor ();
+  }
+
+  ValueT &operator[] (const KeyT &key)
+  {
+    for (auto &element : writable_bucket (hash_func (key)))
+    {
+      if (element.first == key)
+      {
+        return element.second;
+      }
+    }
+    insert (key, ValueT ());
+    return at (key);
+  }
+
+  ValueT operator[] (const KeyT &key) const
+  {
+    const item *found = find_item (table.get (), map_capacity, key);
+    return found == nullptr ? ValueT () : found->second;
+  }
+
+  bool operator== (const CowHashMap &rhs) const
+  {
+    if (map_size != rhs.map_size)
+    {
+      return false;
+    }
+    if (table == rhs.table && map_capacity == rhs.map_capacity)
+    {
+      return true;
+    }
+    for (const auto &element : rhs)
+    {
+      const item *found = find_item (table.get (), map_capacity,
+                                     element.first);
+      if (found == nullptr || found->second != element.second)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool operator!= (const CowHashMap &rhs) const
+  {
+    return !(operator== (rhs));
+  }
+
+  const_iterator begin () const
+  {
+    return const_iterator (table.get (), map_capacity, 0);
+  }
+
+  const_iterator cbegin () const
+  {
+    return begin ();
+  }
+
+  const_iterator end () const
+  {
+    return const_iterator (table.get (), map_capacity, map_capacity);
+  }
+
+  const_iterator cend () const
+  {
+    return end ();
+  }
+};
+
+/**
+ * A Dictionary whose snapshots and copies are O(1), see CowHashMap.
+ */
+class CowDictionary : public CowHashMap<std::string, std::string>
+{
+ public:
+  CowDictionary () {};
+  CowDictionary (const vector<string> &key_vect,
+                 const vector<string> &value_vect):
+      CowHashMap (key_vect, value_vect) {};
+
+  bool erase (const std::string &key) override
+  {
+    if (!contains_key (key))
+    {
+      throw InvalidKey (INVALID_KEY_ERROR);
+    }
+    return CowHashMap<std::string, std::string>::erase (key);
+  }
+
+  template<class DictIterator>
+  void update (DictIterator begin, const DictIterator &end)
+  {
+    while (begin != end)
+    {
+      operator[] ((*begin).first) = (*begin).second;
+      begin++;
+    }
+  }
+};
+
+#endif //_COWHASHMAP_HPP_
@@ -1,6 +1,7 @@
 #ifndef _DICTIONARY_HPP_
 #define _DICTIONARY_HPP_
 #include "HashMap.hpp"
+#include <new>
 
 class InvalidKey: public std::invalid_argument
 {
@@ -23,29 +24,46 @@ class InvalidKey: public std::invalid_argument
   Dictionary(vector<string> key_vect, vector<string> value_vect):
       HashMap(key_vect,value_vect){};
 
+  /**
+   * Constructs a dictionary from vectors of keys and values on several
+   * threads, see the matching HashMap constructor.
+   */
+  Dictionary(parallel_policy policy, const vector<string> &key_vect,
+             const vector<string> &value_vect, unsigned threads = 0):
+      HashMap(policy, key_vect, value_vect, threads){};
+
   Dictionary(const Dictionary &other): HashMap(other){};
+  Dictionary &operator=(const Dictionary &other) = default;
 
     bool erase(const std::string &key) override
    {
-    if (!contains_key (key))
+    if (!try_erase (key))
     {
       throw InvalidKey(INVALID_KEY_ERROR);
     }
-    return HashMap<std::string ,std::string>::erase (key);
+    return true;
    }
 
+  /**
+   * Erases a key without throwing when it is missing.
+   * @return A bool value whether the key was in the dictionary.
+   */
+  bool erase (const std::string &key, const std::nothrow_t &)
+  {
+    return try_erase (key);
+  }
+
+  /**
+   * Assigns every key/value pair of the range, later pairs winning over
+   * earlier ones. A random access range grows the dictionary once up
+   * front, and a large one is assigned in parallel.
+   */
   template<class DictIterator>
   void update (DictIterator begin, const DictIterator &end)
   {
-    while (begin != end)
-    {
-      operator[]((*begin).first) = (*begin).second;
-      if ((double) (size() / capacity()) > (double) UPPER_LOAD_FACTOR)
-      {
-        rehash_func (INCREASE_HASH);
-      }
-      begin++;
-    }
+    assign_range (begin, end,
+                  typename std::iterator_traits<DictIterator>::
+                  iterator_category ());
   }
 };
 
@@ -0,0 +1,459 @@
+#ifndef _DURABLEDICTIONARY_HPP_
+#define _DURABLEDICTIONARY_HPP_
+
+#include "Dictionary.hpp"
+#include <cerrno>
+#include <chrono>
+#include <string>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define WAL_FILE "/wal"
+#define SNAPSHOT_FILE "/snapshot"
+#define SNAPSHOT_TEMP_FILE "/snapshot.tmp"
+#define WAL_RECORD_HEADER_BYTES 13
+#define WAL_GROUP_BYTES (1 << 16)
+#define WAL_OP_SET 1
+#define WAL_OP_ERASE 2
+
+/**
+ * When a DurableDictionary forces its log to disk.
+ */
+enum FsyncPolicy
+{
+  //On every commit, so committed mutations survive a power loss.
+  FSYNC_ALWAYS,
+  //On a commit at least fsync_interval after the last fsync.
+  FSYNC_PERIODIC,
+  //Never; committed mutations survive a crash of the process only.
+  FSYNC_NEVER
+};
+
+struct WalOptions
+{
+  FsyncPolicy fsync_policy = FSYNC_ALWAYS;
+  //Mutations buffered before they are committed with a single write, 1 to
+  //commit each mutation before it returns.
+  size_t group_records = 1;
+  std::chrono::milliseconds fsync_interval = std::chrono::milliseconds (100);
+};
+
+/**
+ * A Dictionary that survives restarts. Each mutation is appended to a
+ * write-ahead log as a checksummed record. Records are buffered and
+ * committed in groups, with one write and, per the fsync policy, one fsync
+ * per group. checkpoint writes a snapshot of the whole dictionary with
+ * Dictionary::serialize and empties the log. Opening the dictionary
+ * replays the log onto the snapshot, up to the first torn or corrupt
+ * record, and cuts the log there. Records set or erase a key, so
+ * replaying them again after a crash during checkpoint gives the same
+ * dictionary.
+ * Reads go straight to the in-memory Dictionary.
+ */
+class DurableDictionary
+{
+  Dictionary contents;
+  std::string directory;
+  WalOptions options;
+  int wal_fd;
+  std::string pending;
+  size_t pending_records;
+  size_t log_bytes;
+  std::chrono::steady_clock::time_point last_sync;
+
+  static void fail (const std::string &what)
+  {
+    throw std::system_error (errno, std::generic_category (), what);
+  }
+
+  static void put_u32 (std::string &out, uint32_t value)
+  {
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+      out.push_back ((char) ((value >> shift) & 0xFF));
+    }
+  }
+
+  static uint32_t get_u32 (const char *in)
+  {
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; i--)
+    {
+      value = (value << 8) | (unsigned char) in[i];
+    }
+    return value;
+  }
+
+  /**
+   * Appends a record: its CRC-32, op, key size, value size, key and value.
+   */
+  static void append_record (std::string &out, char op,
+                             const std::string &key, const std::string &value)
+  {
+    std::string body (1, op);
+    put_u32 (body, (uint32_t) key.size ());
+    put_u32 (body, (uint32_t) value.size ());
+    body += key;
+    body += value;
+    put_u32 (out, crc32 (body.data (), body.size ()));
+    out += body;
+  }
+
+  /**
+   * Applies the valid records of a buffer to a dictionary.
+   * @return The bytes of the valid records, which stop at the first record
+   * that is cut short or fails its checksum.
+   */
+  static size_t replay (const std::string &data, size_t offset,
+                        Dictionary &target)
+  {
+    while (offset + WAL_RECORD_HEADER_BYTES <= data.size ())
+    {
+      const char *record = data.data () + offset;
+      size_t key_size = get_u32 (record + 5);
+      size_t value_size = get_u32 (record + 9);
+      size_t body_size = 1 + 8 + key_size + value_size;
+      if (key_size > data.size () || value_size > data.size ()
+          || offset + 4 + body_size > data.size ()
+          || crc32 (record + 4, body_size) != get_u32 (record))
+      {
+        break;
+      }
+      std::string key (record + WAL_RECORD_HEADER_BYTES, key_size);
+      if (record[4] == WAL_OP_SET)
+      {
+        target[key] = std::string (record + WAL_RECORD_HEADER_BYTES + key_size,
+                                   value_size);
+      }
+      else if (record[4] == WAL_OP_ERASE)
+      {
+        target.erase (key, std::nothrow);
+      }
+      else
+      {
+        break;
+      }
+      offset += 4 + body_size;
+    }
+    return offset;
+  }
+
+  static bool read_file (const std::string &path, std::string &data)
+  {
+    int fd = ::open (path.c_str (), O_RDONLY);
+    if (fd < 0)
+    {
+      if (errno == ENOENT)
+      {
+        return false;
+      }
+      fail ("can't open " + path);
+    }
+    data.clear ();
+    char chunk[WAL_GROUP_BYTES];
+    ssize_t count;
+    while ((count = ::read (fd, chunk, sizeof (chunk))) != 0)
+    {
+      if (count < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        ::close (fd);
+        fail ("can't read " + path);
+      }
+      data.append (chunk, (size_t) count);
+    }
+    ::close (fd);
+    return true;
+  }
+
+  static void write_all (int fd, const char *data, size_t size)
+  {
+    size_t written = 0;
+    while (written < size)
+    {
+      ssize_t count = ::write (fd, data + written, size - written);
+      if (count < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        fail ("can't write to disk");
+      }
+      written += (size_t) count;
+    }
+  }
+
+  void sync_directory () const
+  {
+    int fd = ::open (directory.c_str (), O_RDONLY);
+    if (fd >= 0)
+    {
+      ::fsync (fd);
+      ::close (fd);
+    }
+  }
+
+  /**
+   * Loads the snapshot and replays the log, cutting off its invalid tail.
+   */
+  void recover ()
+  {
+    std::string data;
+    if (read_file (directory + SNAPSHOT_FILE, data))
+    {
+      contents.deserialize (data.data (), data.size ());
+    }
+    wal_fd = ::open ((directory + WAL_FILE).c_str (),
+                     O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (wal_fd < 0)
+    {
+      fail ("can't open the log");
+    }
+    data.clear ();
+    read_file (directory + WAL_FILE, data);
+    log_bytes = replay (data, 0, contents);
+    if (log_bytes < data.size () && ::ftruncate (wal_fd, log_bytes) != 0)
+    {
+      fail ("can't truncate the log");
+    }
+  }
+
+  void log (char op, const std::string &key, const std::string &value)
+  {
+    append_record (pending, op, key, value);
+    pending_records++;
+    if (pending_records >= options.group_records
+        || pending.size () >= WAL_GROUP_BYTES)
+    {
+      commit ();
+    }
+  }
+
+ public:
+  /**
+   * Assigns a value of the dictionary through operator[], logging it.
+   */
+  class value_proxy
+  {
+    friend class DurableDictionary;
+
+    DurableDictionary &dict;
+    std::string key;
+
+    value_proxy (DurableDictionary &_dict, const std::string &_key):
+        dict (_dict), key (_key)
+    {}
+
+   public:
+    value_proxy &operator= (const std::string &value)
+    {
+      dict.set (key, value);
+      return *this;
+    }
+
+    operator const std::string & () const
+    { return dict.contents.at (key); }
+  };
+
+  /**
+   * Opens a durable dictionary in an existing directory, recovering what
+   * it holds.
+   */
+  explicit DurableDictionary (const std::string &_directory,
+                              WalOptions _options = WalOptions ()):
+      directory (_directory), options (_options), wal_fd (-1),
+      pending_records (0), log_bytes (0),
+      last_sync (std::chrono::steady_clock::now ())
+  {
+    if (options.group_records == 0)
+    {
+      options.group_records = 1;
+    }
+    recover ();
+  }
+
+  DurableDictionary (const DurableDictionary &) = delete;
+  DurableDictionary &operator= (const DurableDictionary &) = delete;
+
+  /**
+   * Commits the buffered mutations and forces them to disk.
+   */
+  ~DurableDictionary ()
+  {
+    try
+    {
+      commit ();
+      sync ();
+    }
+    catch (std::exception &err)
+    {
+      //Nothing can be reported from a destructor.
+    }
+    ::close (wal_fd);
+  }
+
+  size_t size () const
+  { return contents.size (); }
+
+  bool empty () const
+  { return contents.empty (); }
+
+  bool contains_key (const std::string &key) const
+  { return contents.contains_key (key); }
+
+  const std::string &at (const std::string &key) const
+  { return contents.at (key); }
+
+  const std::string *find (const std::string &key) const
+  { return contents.find (key); }
+
+  std::string operator[] (const std::string &key) const
+  { return contents.get_or (key, std::string ()); }
+
+  /**
+   * @return A proxy whose assignment sets the value of the key, inserting
+   * the key if needed.
+   */
+  value_proxy operator[] (const std::string &key)
+  {
+    if (!contents.contains_key (key))
+    {
+      set (key, std::string ());
+    }
+    return value_proxy (*this, key);
+  }
+
+  /**
+   * The dictionary itself, for reads and iteration.
+   */
+  const Dictionary &dictionary () const
+  { return contents; }
+
+  bool insert (const std::string &key, const std::string &value)
+  {
+    if (!contents.insert (key, value))
+    {
+      return false;
+    }
+    log (WAL_OP_SET, key, value);
+    return true;
+  }
+
+  /**
+   * Sets the value of a key, inserting the key if needed.
+   */
+  void set (const std::string &key, const std::string &value)
+  {
+    contents[key] = value;
+    log (WAL_OP_SET, key, value);
+  }
+
+  /**
+   * Erases a key, throwing InvalidKey if it is missing, like Dictionary.
+   */
+  bool erase (const std::string &key)
+  {
+    contents.erase (key);
+    log (WAL_OP_ERASE, key, std::string ());
+    return true;
+  }
+
+  bool erase (const std::string &key, const std::nothrow_t &)
+  {
+    if (!contents.erase (key, std::nothrow))
+    {
+      return false;
+    }
+    log (WAL_OP_ERASE, key, std::string ());
+    return true;
+  }
+
+  /**
+   * Writes the buffered mutations to the log with a single write, and
+   * forces them to disk if the fsync policy says so.
+   */
+  void commit ()
+  {
+    if (!pending.empty ())
+    {
+      write_all (wal_fd, pending.data (), pending.size ());
+      log_bytes += pending.size ();
+      pending.clear ();
+      pending_records = 0;
+    }
+    auto now = std::chrono::steady_clock::now ();
+    if (options.fsync_policy == FSYNC_ALWAYS
+        || (options.fsync_policy == FSYNC_PERIODIC
+            && now - last_sync >= options.fsync_interval))
+    {
+      sync ();
+    }
+  }
+
+  /**
+   * Forces the committed mutations to disk, whatever the fsync policy.
+   */
+  void sync ()
+  {
+    if (::fdatasync (wal_fd) != 0)
+    {
+      fail ("can't sync the log");
+    }
+    last_sync = std::chrono::steady_clock::now ();
+  }
+
+  /**
+   * Writes a snapshot of the dictionary next to the old one, renames it
+   * over the old one, and empties the log.
+   */
+  void checkpoint ()
+  {
+    commit ();
+    vector<char> image;
+    contents.serialize (image);
+    std::string temp = directory + SNAPSHOT_TEMP_FILE;
+    int fd = ::open (temp.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+      fail ("can't create the snapshot");
+    }
+    try
+    {
+      write_all (fd, image.data (), image.size ());
+      if (::fsync (fd) != 0)
+      {
+        fail ("can't sync the snapshot");
+      }
+    }
+    catch (std::system_error &)
+    {
+      ::close (fd);
+      throw;
+    }
+    ::close (fd);
+    if (::rename (temp.c_str (), (directory + SNAPSHOT_FILE).c_str ()) != 0)
+    {
+      fail ("can't replace the snapshot");
+    }
+    sync_directory ();
+    if (::ftruncate (wal_fd, 0) != 0)
+    {
+      fail ("can't empty the log");
+    }
+    sync ();
+    log_bytes = 0;
+  }
+
+  /**
+   * @return The bytes of committed records in the log.
+   */
+  size_t wal_bytes () const
+  { return log_bytes; }
+};
+
+#endif //_DURABLEDICTIONARY_HPP_
@@ -0,0 +1,276 @@
+#ifndef _EXPIRINGHASHMAP_HPP_
+#define _EXPIRINGHASHMAP_HPP_
+
+#include "HashMap.hpp"
+#include <chrono>
+#include <stdexcept>
+
+/**
+ * A value stored with the time it expires at.
+ */
+template<class ValueT, class TimePoint>
+struct expiring_value
+{
+  ValueT value;
+  TimePoint expiry;
+};
+
+/**
+ * A hash-map whose entries may expire, for data such as session tokens.
+ * An expired entry is never returned. It is erased lazily when a lookup or
+ * erase finds it, or by sweep, which visits a bounded number of buckets per
+ * call so expiry can run in small steps, e.g. between requests.
+ * While a sweep is in progress the map doesn't shrink; it shrinks once,
+ * if needed, when the sweep completes. size counts the expired entries that
+ * weren't erased yet.
+ * @tparam Clock - The clock entries expire by, steady_clock by default.
+ */
+template<class KeyT, class ValueT, class Clock = std::chrono::steady_clock>
+class ExpiringHashMap:
+    protected HashMap<KeyT, expiring_value<ValueT, typename Clock::time_point>>
+{
+ public:
+  typedef typename Clock::time_point time_point;
+  typedef typename Clock::duration duration;
+
+ private:
+  typedef expiring_value<ValueT, time_point> entry;
+  typedef HashMap<KeyT, entry> base;
+
+  //The next bucket to sweep, and the capacity the sweep started with.
+  size_t sweep_cursor;
+  size_t sweep_capacity;
+
+  static bool expired (const entry &curr, const time_point &now)
+  { return curr.expiry <= now; }
+
+  /**
+   * @return The live entry of the key, or nullptr.
+   */
+  const entry *find_live (const KeyT &key) const
+  {
+    const auto *found = this->find_item (key);
+    if (found == nullptr || expired (found->second, Clock::now ()))
+    {
+      return nullptr;
+    }
+    return &found->second;
+  }
+
+  /**
+   * Erases the entry of the key if it has expired.
+   * @return Whether the key has a live entry.
+   */
+  bool drop_if_expired (const KeyT &key)
+  {
+    const auto *found = this->find_item (key);
+    if (found == nullptr)
+    {
+      return false;
+    }
+    if (expired (found->second, Clock::now ()))
+    {
+      this->remove_item (key, !sweep_in_progress ());
+      return false;
+    }
+    return true;
+  }
+
+ public:
+  ExpiringHashMap (): sweep_cursor (0), sweep_capacity (0)
+  {}
+
+  using base::size;
+  using base::capacity;
+  using base::empty;
+
+  /**
+   * @return A time point entries without a time to live expire at, i.e.
+   * never.
+   */
+  static time_point never ()
+  { return time_point::max (); }
+
+  /**
+   * Inserts a key unless it has a live entry. An expired entry of the key
+   * is replaced.
+   * @param ttl - How long the entry lives.
+   * @return Whether the entry was inserted.
+   */
+  bool insert (const KeyT &key, const ValueT &value, duration ttl)
+  {
+    return insert_until (key, value, Clock::now () + ttl);
+  }
+
+  /**
+   * Inserts an entry that never expires, see insert.
+   */
+  bool insert (const KeyT &key, const ValueT &value)
+  {
+    return insert_until (key, value, never ());
+  }
+
+  /**
+   * Inserts an entry that expires at a given time, see insert.
+   */
+  bool insert_until (const KeyT &key, const ValueT &value, time_point expiry)
+  {
+    if (drop_if_expired (key))
+    {
+      return false;
+    }
+    return base::insert (key, entry {value, expiry});
+  }
+
+  /**
+   * Sets the value of a key, replacing any entry it has.
+   * @param ttl - How long the entry lives.
+   */
+  void put (const KeyT &key, const ValueT &value, duration ttl)
+  {
+    entry *found = base::find (key);
+    if (found != nullptr)
+    {
+      *found = entry {value, Clock::now () + ttl};
+      return;
+    }
+    base::insert (key, entry {value, Clock::now () + ttl});
+  }
+
+  /**
+   * Gives a live entry a new time to live, e.g. when a session is used.
+   * @return Whether the key has a live entry.
+   */
+  bool expire_after (const KeyT &key, duration ttl)
+  {
+    if (!drop_if_expired (key))
+    {
+      return false;
+    }
+    base::at (key).expiry = Clock::now () + ttl;
+    return true;
+  }
+
+  /**
+   * @return The time the entry of the key expires at.
+   */
+  time_point expiry (const KeyT &key) const
+  {
+    const entry *found = find_live (key);
+    if (found == nullptr)
+    {
+      throw std::runtime_error (INVALID_KEY_ERROR);
+    }
+    return found->expiry;
+  }
+
+  bool contains_key (const KeyT &key) const
+  { return find_live (key) != nullptr; }
+
+  /**
+   * @return A pointer to the value of a live entry, or nullptr.
+   */
+  const ValueT *find (const KeyT &key) const
+  {
+    const entry *found = find_live (key);
+    return found == nullptr ? nullptr : &found->value;
+  }
+
+  /**
+   * Like the const find, but also erases the key's entry if it expired.
+   */
+  ValueT *find (const KeyT &key)
+  {
+    if (!drop_if_expired (key))
+    {
+      return nullptr;
+    }
+    return &base::at (key).value;
+  }
+
+  const ValueT &at (const KeyT &key) const
+  {
+    const ValueT *found = find (key);
+    if (found == nullptr)
+    {
+      throw std::runtime_error (INVALID_KEY_ERROR);
+    }
+    return *found;
+  }
+
+  /**
+   * Erases the entry of a key.
+   * @return Whether the key had a live entry.
+   */
+  bool erase (const KeyT &key)
+  {
+    if (!drop_if_expired (key))
+    {
+      return false;
+    }
+    return this->remove_item (key, !sweep_in_progress ());
+  }
+
+  /**
+   * Erases the expired entries of up to max_buckets buckets, continuing
+   * from where the previous call stopped. If the map was rehashed since,
+   * the sweep starts over. When the last bucket is swept, the sweep is
+   * complete and the map shrinks if it is sparse.
+   * @return The number of entries erased.
+   */
+  size_t sweep (size_t max_buckets)
+  {
+    if (this->hash_table == nullptr)
+    {
+      return 0;
+    }
+    if (sweep_capacity != this->map_capacity)
+    {
+      sweep_cursor = 0;
+      sweep_capacity = this->map_capacity;
+    }
+    time_point now = Clock::now ();
+    size_t erased = 0;
+    for (size_t swept = 0;
+         swept < max_buckets && sweep_cursor < sweep_capacity; swept++)
+    {
+      auto &curr_bucket = *(this->hash_table + sweep_cursor++);
+      auto is_expired = [&now] (const auto &element)
+      { return expired (element.second, now); };
+      auto live_end = std::remove_if (curr_bucket.begin (), curr_bucket.end (),
+                                      is_expired);
+      erased += curr_bucket.end () - live_end;
+      curr_bucket.erase (live_end, curr_bucket.end ());
+    }
+    this->map_size -= erased;
+    this->update_load_factor ();
+    if (sweep_cursor == sweep_capacity)
+    {
+      sweep_cursor = 0;
+      this->shrink_if_sparse ();
+      sweep_capacity = this->map_capacity;
+    }
+    return erased;
+  }
+
+  /**
+   * Sweeps every bucket, see sweep.
+   * @return The number of entries erased.
+   */
+  size_t sweep_all ()
+  {
+    sweep_cursor = 0;
+    return sweep (this->map_capacity);
+  }
+
+  bool sweep_in_progress () const
+  { return sweep_cursor != 0; }
+
+  void clear ()
+  {
+    base::clear ();
+    sweep_cursor = 0;
+  }
+};
+
+#endif //_EXPIRINGHASHMAP_HPP_
@@ -0,0 +1,622 @@
+#ifndef _FILTEREDDICTIONARY_HPP_
+#define _FILTEREDDICTIONARY_HPP_
+
+#include "Dictionary.hpp"
+#define FILTER_HASH_MULTIPLIER 0x9E3779B97F4A7C15ULL
+#define BLOOM_BLOCK_WORDS 8
+#define BLOOM_BITS_PER_KEY 16
+#define BLOOM_MIN_ITEMS 64
+#define XOR_FILTER_EXTRA_SLOTS 32
+#define XOR_FILTER_MAX_ATTEMPTS 64
+
+/**
+ * Mixes a key's hash so filters get well spread bits even from weak hashes.
+ */
+inline uint64_t filter_mix (uint64_t full_hash)
+{
+  full_hash ^= full_hash >> 33;
+  full_hash *= FILTER_HASH_MULTIPLIER;
+  full_hash ^= full_hash >> 29;
+  return full_hash;
+}
+
+/**
+ * @return A value in [0, range) taken from the high bits of value.
+ */
+inline size_t filter_reduce (uint32_t value, size_t range)
+{
+  return (size_t) (((uint64_t) value * range) >> 32);
+}
+
+/**
+ * A split block Bloom filter. A key sets one bit in each of the
+ * BLOOM_BLOCK_WORDS words of a single 64-byte block, so adding or testing
+ * a key touches one cache line. Keys can't be removed.
+ */
+class blocked_bloom_filter
+{
+  struct block
+  {
+    uint64_t words[BLOOM_BLOCK_WORDS];
+  };
+
+  vector<block> blocks;
+
+  static uint64_t bit_of (uint32_t key_bits, int word)
+  {
+    static const uint32_t salts[BLOOM_BLOCK_WORDS] =
+        {0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+         0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+    return 1ULL << ((key_bits * salts[word]) >> 26);
+  }
+
+ public:
+  /**
+   * @param items - The number of keys the filter is sized for, at
+   * BLOOM_BITS_PER_KEY bits per key.
+   */
+  explicit blocked_bloom_filter (size_t items = 0):
+      blocks (items * BLOOM_BITS_PER_KEY / (8 * sizeof (block)) + 1)
+  {}
+
+  void add (uint64_t mixed_hash)
+  {
+    block &curr = blocks[filter_reduce (mixed_hash >> 32, blocks.size ())];
+    for (int word = 0; word < BLOOM_BLOCK_WORDS; word++)
+    {
+      curr.words[word] |= bit_of ((uint32_t) mixed_hash, word);
+    }
+  }
+
+  /**
+   * @return false if the key was never added, true if it probably was.
+   */
+  bool may_contain (uint64_t mixed_hash) const
+  {
+    const block &curr = blocks[filter_reduce (mixed_hash >> 32,
+                                              blocks.size ())];
+    for (int word = 0; word < BLOOM_BLOCK_WORDS; word++)
+    {
+      uint64_t bit = bit_of ((uint32_t) mixed_hash, word);
+      if ((curr.words[word] & bit) == 0)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  size_t memory_bytes () const
+  { return blocks.size () * sizeof (block); }
+};
+
+/**
+ * An xor filter with 8-bit fingerprints, built once from a fixed set of
+ * keys. It takes about 1.23 bytes per key, less than a Bloom filter with
+ * the same false positive rate (about 0.4%), and a lookup reads three
+ * bytes. Keys can't be added after it is built.
+ */
+class xor_filter
+{
+  vector<uint8_t> fingerprints;
+  size_t block_length;
+  uint64_t seed;
+
+  static uint64_t rotate (uint64_t value, int bits)
+  {
+    return bits == 0 ? value : (value << bits) | (value >> (64 - bits));
+  }
+
+  uint64_t seeded (uint64_t mixed_hash) const
+  { return filter_mix (mixed_hash + seed); }
+
+  static uint8_t fingerprint (uint64_t key_hash)
+  { return (uint8_t) (key_hash ^ (key_hash >> 32)); }
+
+  size_t slot (uint64_t key_hash, int index) const
+  {
+    return index * block_length
+           + filter_reduce ((uint32_t) rotate (key_hash, 21 * index),
+                            block_length);
+  }
+
+  /**
+   * Finds an order in which every key owns one of its three slots, by
+   * repeatedly peeling keys off slots that only they map to.
+   * @return Whether every key was peeled, with the keys and their slots
+   * pushed to order in peeling order.
+   */
+  bool peel (const vector<uint64_t> &hashes,
+             vector<pair<uint64_t, size_t>> &order) const
+  {
+    size_t slots = fingerprints.size ();
+    vector<uint8_t> counts (slots, 0);
+    vector<uint64_t> xored (slots, 0);
+    for (uint64_t mixed_hash : hashes)
+    {
+      uint64_t key_hash = seeded (mixed_hash);
+      for (int index = 0; index < 3; index++)
+      {
+        size_t curr = slot (key_hash, index);
+        counts[curr]++;
+        xored[curr] ^= key_hash;
+      }
+    }
+    vector<size_t> single;
+    for (size_t curr = 0; curr < slots; curr++)
+    {
+      if (counts[curr] == 1)
+      {
+        single.push_back (curr);
+      }
+    }
+    order.clear ();
+    while (!single.empty ())
+    {
+      size_t curr = single.back ();
+      single.pop_back ();
+      if (counts[curr] != 1)
+      {
+        continue;
+      }
+      uint64_t key_hash = xored[curr];
+      order.emplace_back (key_hash, curr);
+      for (int index = 0; index < 3; index++)
+      {
+        size_t other = slot (key_hash, index);
+        counts[other]--;
+        xored[other] ^= key_hash;
+        if (counts[other] == 1)
+        {
+          single.push_back (other);
+        }
+      }
+    }
+    return order.size () == hashes.size ();
+  }
+
+ public:
+  xor_filter (): block_length (0), seed (0)
+  {}
+
+  /**
+   * Builds the filter from the mixed hashes of its keys. Duplicate hashes
+   * are allowed.
+   */
+  explicit xor_filter (vector<uint64_t> hashes): seed (0)
+  {
+    std::sort (hashes.begin (), hashes.end ());
+    hashes.erase (std::unique (hashes.begin (), hashes.end ()),
+                  hashes.end ());
+    block_length = (hashes.size () * 123 / 100 + XOR_FILTER_EXTRA_SLOTS) / 3;
+    fingerprints.assign (3 * block_length, 0);
+    vector<pair<uint64_t, size_t>> order;
+    for (int attempt = 0; !peel (hashes, order); attempt++)
+    {
+      if (attempt == XOR_FILTER_MAX_ATTEMPTS)
+      {
+        throw std::runtime_error ("ERROR: can't build the xor filter.");
+      }
+      seed = filter_mix (seed + FILTER_HASH_MULTIPLIER);
+    }
+    for (auto it = order.rbegin (); it != order.rend (); ++it)
+    {
+      uint8_t value = fingerprint (it->first);
+      for (int index = 0; index < 3; index++)
+      {
+        value ^= fingerprints[slot (it->first, index)];
+      }
+      fingerprints[it->second] = value;
+    }
+  }
+
+  /**
+   * @return false if the key isn't in the filter, true if it probably is.
+   */
+  bool may_contain (uint64_t mixed_hash) const
+  {
+    if (fingerprints.empty ())
+    {
+      return false;
+    }
+    uint64_t key_hash = seeded (mixed_hash);
+    return fingerprint (key_hash) == (fingerprints[slot (key_hash, 0)]
+                                      ^ fingerprints[slot (key_hash, 1)]
+                                      ^ fingerprints[slot (key_hash, 2)]);
+  }
+
+  size_t memory_bytes () const
+  { return fingerprints.size (); }
+};
+
+enum FilterKind { BLOOM_FILTER, XOR_FILTER };
+
+/**
+ * The state of a FilteredDictionary's membership filter.
+ */
+struct FilterStats
+{
+  FilterKind kind;
+  //Memory used by the filter itself.
+  size_t filter_bytes;
+  //Keys of the dictionary.
+  size_t items;
+  //Erased keys that are still in the filter, until it is rebuilt.
+  size_t stale_items;
+
+  double bits_per_key () const
+  { return items == 0 ? 0 : 8.0 * filter_bytes / items; }
+};
+
+/**
+ * A Dictionary with a membership filter in front of its table, so lookups
+ * of missing keys are usually answered without touching a bucket or
+ * comparing strings. The filter never misses a key of the dictionary.
+ * While the dictionary is written it is a blocked Bloom filter that grows
+ * and is rebuilt as needed. Once the dictionary is frozen it is replaced by
+ * a smaller xor filter, until the next insertion.
+ * The Dictionary is a protected base, so every write goes through this
+ * class and reaches the filter; dictionary gives it for reads.
+ */
+class FilteredDictionary: protected Dictionary
+{
+  blocked_bloom_filter bloom;
+  xor_filter frozen_filter;
+  bool frozen;
+  //Keys the Bloom filter was sized for, and keys added to it.
+  size_t filter_capacity;
+  size_t filter_items;
+  size_t stale_items;
+
+  static uint64_t mixed_hash_of (const std::string &key)
+  { return filter_mix (hash<std::string> {} (key)); }
+
+  bool may_contain (uint64_t mixed_hash) const
+  {
+    return frozen ? frozen_filter.may_contain (mixed_hash)
+                  : bloom.may_contain (mixed_hash);
+  }
+
+  /**
+   * Makes room in the Bloom filter for count more keys, rebuilding it
+   * first if it is frozen or full.
+   */
+  void reserve_filter (size_t count)
+  {
+    if (frozen || filter_items + count > filter_capacity)
+    {
+      rebuild_filter (2 * (size () + count));
+    }
+  }
+
+  void add_to_filter (uint64_t mixed_hash)
+  {
+    bloom.add (mixed_hash);
+    filter_items++;
+  }
+
+  /**
+   * Adds the keys of a map about to be merged in to the filter.
+   */
+  void filter_keys_of (const HashMap &other)
+  {
+    reserve_filter (other.size ());
+    for (const auto &element : other)
+    {
+      add_to_filter (mixed_hash_of (element.first));
+    }
+  }
+
+  /**
+   * Counts an erased key, and rebuilds the filter once most of its keys
+   * are stale, so misses keep being filtered out.
+   */
+  void note_erased ()
+  {
+    stale_items++;
+    if (stale_items > size () && stale_items > BLOOM_MIN_ITEMS)
+    {
+      if (frozen)
+      {
+        freeze ();
+      }
+      else
+      {
+        rebuild_filter (2 * size ());
+      }
+    }
+  }
+
+  /**
+   * Assigns the pairs of an input range one at a time, since it can be
+   * walked only once.
+   */
+  template<class DictIterator>
+  void update_range (DictIterator begin, const DictIterator &end,
+                     std::input_iterator_tag)
+  {
+    for (; begin != end; ++begin)
+    {
+      (*this)[begin->first] = begin->second;
+    }
+  }
+
+  /**
+   * Makes room in the filter for the keys of a forward range at once and
+   * adds them, then assigns the range, see Dictionary::update.
+   */
+  template<class DictIterator>
+  void update_range (DictIterator begin, const DictIterator &end,
+                     std::forward_iterator_tag)
+  {
+    reserve_filter ((size_t) std::distance (begin, end));
+    for (DictIterator curr = begin; curr != end; ++curr)
+    {
+      add_to_filter (mixed_hash_of (curr->first));
+    }
+    Dictionary::update (begin, end);
+  }
+
+  void rebuild_filter (size_t capacity)
+  {
+    filter_capacity = std::max (capacity, (size_t) BLOOM_MIN_ITEMS);
+    bloom = blocked_bloom_filter (filter_capacity);
+    frozen_filter = xor_filter ();
+    frozen = false;
+    filter_items = 0;
+    stale_items = 0;
+    for (const auto &element : *this)
+    {
+      add_to_filter (mixed_hash_of (element.first));
+    }
+  }
+
+ public:
+  using Dictionary::const_iterator;
+  using Dictionary::Diff;
+
+  FilteredDictionary (): frozen (false), filter_capacity (0),
+                         filter_items (0), stale_items (0)
+  {
+    rebuild_filter (0);
+  }
+
+  FilteredDictionary (vector<string> key_vect, vector<string> value_vect):
+      Dictionary (key_vect, value_vect), frozen (false), filter_capacity (0),
+      filter_items (0), stale_items (0)
+  {
+    rebuild_filter (2 * size ());
+  }
+
+  using Dictionary::size;
+  using Dictionary::capacity;
+  using Dictionary::empty;
+  using Dictionary::get_load_factor;
+  using Dictionary::bucket_size;
+  using Dictionary::bucket_index;
+  using Dictionary::reserve;
+  using Dictionary::serialize;
+  using Dictionary::diff;
+  using Dictionary::begin;
+  using Dictionary::end;
+  using Dictionary::cbegin;
+  using Dictionary::cend;
+  using Dictionary::operator==;
+  using Dictionary::operator!=;
+
+  /**
+   * The dictionary itself, for reads and for passing it on as a Dictionary.
+   */
+  const Dictionary &dictionary () const
+  { return *this; }
+
+  bool operator== (const FilteredDictionary &rhs) const
+  { return dictionary () == rhs.dictionary (); }
+
+  bool operator!= (const FilteredDictionary &rhs) const
+  { return !(*this == rhs); }
+
+  bool insert (const std::string &key, const std::string &value)
+  {
+    if (!Dictionary::insert (key, value))
+    {
+      return false;
+    }
+    reserve_filter (1);
+    add_to_filter (mixed_hash_of (key));
+    return true;
+  }
+
+  bool erase (const std::string &key) override
+  {
+    Dictionary::erase (key);
+    note_erased ();
+    return true;
+  }
+
+  bool erase (const std::string &key, const std::nothrow_t &)
+  {
+    if (!Dictionary::try_erase (key))
+    {
+      return false;
+    }
+    note_erased ();
+    return true;
+  }
+
+  /**
+   * Erases a key without throwing when it is missing.
+   * @return Whether the key was in the dictionary.
+   */
+  bool try_erase (const std::string &key)
+  {
+    return erase (key, std::nothrow);
+  }
+
+  /**
+   * Assigns every key/value pair of a range, later pairs winning over
+   * earlier ones. The filter grows once for a forward range; an input
+   * range is assigned a pair at a time.
+   */
+  template<class DictIterator>
+  void update (DictIterator begin, const DictIterator &end)
+  {
+    update_range (begin, end,
+                  typename std::iterator_traits<DictIterator>::
+                  iterator_category ());
+  }
+
+  void merge (HashMap &&other, MergePolicy policy = OVERWRITE_EXISTING)
+  {
+    filter_keys_of (other);
+    Dictionary::merge (std::move (other), policy);
+  }
+
+  /**
+   * See HashMap::merge (HashMap &&, Combine).
+   */
+  template<class Combine>
+  void merge (HashMap &&other, Combine combine)
+  {
+    filter_keys_of (other);
+    Dictionary::merge (std::move (other), combine);
+  }
+
+  void apply (const Diff &changes)
+  {
+    reserve_filter (changes.added.size ());
+    for (const auto &element : changes.added)
+    {
+      add_to_filter (mixed_hash_of (element.first));
+    }
+    //Only keys that were in the dictionary go stale in the filter.
+    size_t erased = 0;
+    for (const auto &key : changes.removed)
+    {
+      if (Dictionary::contains_key (key))
+      {
+        erased++;
+      }
+    }
+    Dictionary::apply (changes);
+    stale_items += erased;
+  }
+
+  void clear ()
+  {
+    Dictionary::clear ();
+    rebuild_filter (0);
+  }
+
+  /**
+   * Loads an image written by serialize and builds a new Bloom filter of
+   * its keys. A filter left stale by a failed load only lets more misses
+   * through.
+   */
+  size_t deserialize (const char *data, size_t size)
+  {
+    size_t image_size = Dictionary::deserialize (data, size);
+    rebuild_filter (2 * this->size ());
+    return image_size;
+  }
+
+  void deserialize (std::istream &in)
+  {
+    Dictionary::deserialize (in);
+    rebuild_filter (2 * size ());
+  }
+
+  bool contains_key (const std::string &key) const
+  {
+    size_t full_hash = hash<std::string> {} (key);
+    return may_contain (filter_mix (full_hash))
+           && find_item (key, full_hash) != nullptr;
+  }
+
+  const std::string *find (const std::string &key) const
+  {
+    size_t full_hash = hash<std::string> {} (key);
+    if (!may_contain (filter_mix (full_hash)))
+    {
+      return nullptr;
+    }
+    const auto *found = find_item (key, full_hash);
+    return found == nullptr ? nullptr : &found->second;
+  }
+
+  std::string *find (const std::string &key)
+  {
+    const FilteredDictionary &self = *this;
+    return const_cast<std::string *> (self.find (key));
+  }
+
+  std::string &at (const std::string &key) const
+  {
+    const std::string *found = find (key);
+    if (found == nullptr)
+    {
+      throw std::runtime_error (INVALID_KEY_ERROR);
+    }
+    return const_cast<std::string &> (*found);
+  }
+
+  std::string get_or (const std::string &key,
+                      const std::string &default_value) const
+  {
+    const std::string *found = find (key);
+    return found == nullptr ? default_value : *found;
+  }
+
+  std::string &operator[] (const std::string &key)
+  {
+    std::string *found = find (key);
+    if (found != nullptr)
+    {
+      return *found;
+    }
+    insert (key, std::string ());
+    return *find (key);
+  }
+
+  std::string operator[] (const std::string &key) const
+  {
+    return get_or (key, std::string ());
+  }
+
+  /**
+   * Replaces the Bloom filter by an xor filter of the current keys, for a
+   * dictionary that is done being written. The next insertion brings the
+   * Bloom filter back.
+   */
+  void freeze ()
+  {
+    vector<uint64_t> hashes;
+    hashes.reserve (size ());
+    for (const auto &element : *this)
+    {
+      hashes.push_back (mixed_hash_of (element.first));
+    }
+    frozen_filter = xor_filter (std::move (hashes));
+    bloom = blocked_bloom_filter ();
+    frozen = true;
+    filter_capacity = 0;
+    filter_items = 0;
+    stale_items = 0;
+  }
+
+  bool is_frozen () const
+  { return frozen; }
+
+  FilterStats stats () const
+  {
+    FilterStats result;
+    result.kind = frozen ? XOR_FILTER : BLOOM_FILTER;
+    result.filter_bytes = frozen ? frozen_filter.memory_bytes ()
+                                 : bloom.memory_bytes ();
+    result.items = size ();
+    result.stale_items = stale_items;
+    return result;
+  }
+};
+
+#endif //_FILTEREDDICTIONARY_HPP_
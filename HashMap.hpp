@@ -2,11 +2,22 @@
 #define _HASHMAP_HPP_
 
 #include <memory>
+#include <new>
 #include <vector>
 #include <list>
 #include <algorithm>
 #include <iostream>
 #include <exception>
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <iterator>
+#include <thread>
+#include <atomic>
+#if defined (__x86_64__)
+#include <immintrin.h>
+#endif
 #define LOWER_LOAD_FACTOR 1/4
 #define UPPER_LOAD_FACTOR 3/4
 #define EMPTY_HASH 0
@@ -16,6 +27,16 @@
 #define INVALID_KEY_ERROR "USAGE: given key doesn't exists in the container."
 #define INCREASE_HASH 1
 #define DECREASE_HASH 0
+#define PARALLEL_UPDATE_MIN_ITEMS (1 << 16)
+#define PARTITIONS_PER_THREAD 8
+#define BATCH_LOOKUP_WIDTH 16
+#define SERIAL_MAGIC "HMAP"
+#define SERIAL_VERSION 1
+#define SERIAL_HEADER_BYTES 32
+#define SERIAL_CHECKSUM_BYTES 4
+#define SERIAL_READ_CHUNK (1 << 20)
+#define SERIAL_FORMAT_ERROR "ERROR: not a valid serialized map of this type."
+#define SERIAL_WRITE_ERROR "ERROR: can't write the serialized map."
 
 using std::hash;
 using std::vector;
@@ -23,20 +44,416 @@ using std::list;
 using std::pair;
 using std::string;
 
+/**
+ * The default allocation policy of a HashMap's buckets array: plain heap
+ * memory. A policy provides allocate(bytes) and deallocate(table, bytes),
+ * returning memory aligned like operator new, and compares equal to the
+ * policies that can free its memory.
+ */
+struct heap_table_allocator
+{
+  void *allocate (size_t bytes)
+  {
+    return ::operator new (bytes);
+  }
+
+  void deallocate (void *table, size_t)
+  {
+    ::operator delete (table);
+  }
+
+  bool operator== (const heap_table_allocator &) const
+  {
+    return true;
+  }
+};
+
+/**
+ * Whether HashMap keeps the full hash of each key next to its item, so a
+ * rehash doesn't hash the keys again and bucket scans compare hashes before
+ * keys. It is on for keys that aren't arithmetic types or pointers, whose
+ * hashing and comparison are cheap anyway. Specialize it to choose
+ * otherwise for a key type.
+ */
+template<class KeyT>
+struct cache_hash_code
+    : std::integral_constant<bool, !std::is_arithmetic<KeyT>::value
+                                   && !std::is_pointer<KeyT>::value>
+{};
+
+/**
+ * An item of a HashMap bucket, with the full hash of its key when
+ * cache_hash_code is set for the key type.
+ */
+template<class KeyT, class ValueT, bool Cached = cache_hash_code<KeyT>::value>
+struct hash_entry : pair<KeyT, ValueT>
+{
+  size_t hash_code;
+
+  hash_entry (const KeyT &key, const ValueT &value, size_t _hash_code):
+      pair<KeyT, ValueT> (key, value), hash_code (_hash_code)
+  {}
+
+  size_t full_hash () const
+  { return hash_code; }
+
+  bool has_hash (size_t other_hash) const
+  { return hash_code == other_hash; }
+
+  bool same_hash (const hash_entry &other) const
+  { return hash_code == other.hash_code; }
+};
+
 template<class KeyT, class ValueT>
+struct hash_entry<KeyT, ValueT, false> : pair<KeyT, ValueT>
+{
+  hash_entry (const KeyT &key, const ValueT &value, size_t):
+      pair<KeyT, ValueT> (key, value)
+  {}
+
+  size_t full_hash () const
+  { return hash<KeyT> {} (this->first); }
+
+  bool has_hash (size_t) const
+  { return true; }
+
+  bool same_hash (const hash_entry &) const
+  { return true; }
+};
+
+/**
+ * What HashMap::merge does with a key that is in both maps.
+ */
+enum MergePolicy
+{
+  KEEP_EXISTING,
+  OVERWRITE_EXISTING
+};
+
+/**
+ * Hashes many keys at once, each to the same hash as hash<KeyT>. This
+ * version hashes them one by one; specialize it for key types that can be
+ * hashed faster in batches.
+ */
+template<class KeyT, class Enable = void>
+struct hash_batch
+{
+  static void apply (const KeyT *keys, size_t count, size_t *hashes)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      hashes[i] = hash<KeyT> {} (keys[i]);
+    }
+  }
+};
+
+#if defined (__GLIBCXX__) && defined (__x86_64__)
+/**
+ * libstdc++ hashes an integer to itself converted to size_t, so a batch of
+ * 32-bit integers is hashed by widening them, 16 at a time with AVX-512 or
+ * 8 at a time with AVX2, whichever the CPU has.
+ */
+template<class KeyT>
+struct hash_batch<KeyT, typename std::enable_if<std::is_integral<KeyT>::value
+                                                && sizeof (KeyT) == 4>::type>
+{
+  typedef void (*kernel) (const KeyT *, size_t, size_t *);
+
+  static void scalar (const KeyT *keys, size_t count, size_t *hashes)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      hashes[i] = hash<KeyT> {} (keys[i]);
+    }
+  }
+
+  __attribute__ ((target ("avx2")))
+  static void avx2 (const KeyT *keys, size_t count, size_t *hashes)
+  {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+      for (size_t half = 0; half < 8; half += 4)
+      {
+        __m128i narrow = _mm_loadu_si128 ((const __m128i *) (keys + i + half));
+        __m256i wide = std::is_signed<KeyT>::value
+                       ? _mm256_cvtepi32_epi64 (narrow)
+                       : _mm256_cvtepu32_epi64 (narrow);
+        _mm256_storeu_si256 ((__m256i *) (hashes + i + half), wide);
+      }
+    }
+    scalar (keys + i, count - i, hashes + i);
+  }
+
+  __attribute__ ((target ("avx512f")))
+  static void avx512 (const KeyT *keys, size_t count, size_t *hashes)
+  {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+      for (size_t half = 0; half < 16; half += 8)
+      {
+        __m256i narrow = _mm256_loadu_si256 ((const __m256i *) (keys + i
+                                                                + half));
+        __m512i wide = std::is_signed<KeyT>::value
+                       ? _mm512_cvtepi32_epi64 (narrow)
+                       : _mm512_cvtepu32_epi64 (narrow);
+        _mm512_storeu_si512 (hashes + i + half, wide);
+      }
+    }
+    scalar (keys + i, count - i, hashes + i);
+  }
+
+  /**
+   * @return The widest kernel the CPU runs.
+   */
+  static kernel best ()
+  {
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx512f"))
+    {
+      return avx512;
+    }
+    if (__builtin_cpu_supports ("avx2"))
+    {
+      return avx2;
+    }
+    return scalar;
+  }
+
+  static void apply (const KeyT *keys, size_t count, size_t *hashes)
+  {
+    static const kernel chosen = best ();
+    chosen (keys, count, hashes);
+  }
+};
+
+/**
+ * 64-bit integers hash to themselves under libstdc++, so a batch is a copy.
+ */
+template<class KeyT>
+struct hash_batch<KeyT, typename std::enable_if<std::is_integral<KeyT>::value
+                                                && sizeof (KeyT) == 8>::type>
+{
+  static void apply (const KeyT *keys, size_t count, size_t *hashes)
+  {
+    if (count > 0)
+    {
+      std::memcpy (hashes, keys, count * sizeof (size_t));
+    }
+  }
+};
+#endif
+
+/**
+ * Selects the constructors that build a map on several threads.
+ */
+struct parallel_policy
+{};
+
+const parallel_policy parallel_execution {};
+
+/**
+ * Runs task(0) .. task(count - 1) on count threads, the calling thread
+ * included, and waits for all of them. The first exception thrown by a task
+ * is rethrown once every thread has finished.
+ */
+template<class Task>
+void run_on_threads (unsigned count, const Task &task)
+{
+  vector<std::thread> threads;
+  vector<std::exception_ptr> errors (count);
+  auto guarded = [&task, &errors] (unsigned index)
+  {
+    try
+    {
+      task (index);
+    }
+    catch (...)
+    {
+      errors[index] = std::current_exception ();
+    }
+  };
+  for (unsigned i = 1; i < count; i++)
+  {
+    threads.emplace_back (guarded, i);
+  }
+  guarded (0);
+  for (auto &thread : threads)
+  {
+    thread.join ();
+  }
+  for (const auto &error : errors)
+  {
+    if (error)
+    {
+      std::rethrow_exception (error);
+    }
+  }
+}
+
+/**
+ * @return The CRC-32 of a buffer, continuing from crc for a buffer that
+ * is checksummed in pieces. Eight bytes are folded in per step with eight
+ * lookup tables (slicing-by-8), several times faster than a byte per step.
+ */
+inline uint32_t crc32 (const char *data, size_t size, uint32_t crc = 0)
+{
+  struct crc_tables
+  {
+    uint32_t entries[8][256];
+
+    crc_tables ()
+    {
+      for (uint32_t i = 0; i < 256; i++)
+      {
+        uint32_t entry = i;
+        for (int bit = 0; bit < 8; bit++)
+        {
+          entry = (entry >> 1) ^ ((entry & 1) ? 0xEDB88320U : 0);
+        }
+        entries[0][i] = entry;
+      }
+      for (int table = 1; table < 8; table++)
+      {
+        for (int i = 0; i < 256; i++)
+        {
+          uint32_t previous = entries[table - 1][i];
+          entries[table][i] = (previous >> 8) ^ entries[0][previous & 0xFF];
+        }
+      }
+    }
+  };
+  static const crc_tables tables;
+  const uint32_t (&t)[8][256] = tables.entries;
+  const unsigned char *in = reinterpret_cast<const unsigned char *> (data);
+  crc = ~crc;
+  for (; size >= 8; size -= 8, in += 8)
+  {
+    uint32_t low = crc ^ ((uint32_t) in[0] | (uint32_t) in[1] << 8
+                          | (uint32_t) in[2] << 16 | (uint32_t) in[3] << 24);
+    crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF]
+          ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24]
+          ^ t[3][in[4]] ^ t[2][in[5]] ^ t[1][in[6]] ^ t[0][in[7]];
+  }
+  for (; size > 0; size--, in++)
+  {
+    crc = t[0][(crc ^ *in) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+/**
+ * How HashMap::serialize encodes a key or a value. Trivially copyable
+ * types are copied byte for byte, in the byte order of the machine that
+ * writes them. Specialize it, with the same members, to serialize other
+ * types.
+ */
+template<class T, bool Trivial = std::is_trivially_copyable<T>::value>
+struct serial_codec;
+
+template<class T>
+struct serial_codec<T, true>
+{
+  //The size of every encoding, or 0 if encodings vary in size.
+  static const uint32_t fixed_size = sizeof (T);
+
+  static size_t size (const T &)
+  { return sizeof (T); }
+
+  /**
+   * @return The byte after the encoding of value, written at out.
+   */
+  static char *write (char *out, const T &value)
+  {
+    std::memcpy (out, &value, sizeof (T));
+    return out + sizeof (T);
+  }
+
+  /**
+   * Decodes value from the bytes between in and end.
+   * @return The byte after its encoding, or nullptr if it runs past end.
+   */
+  static const char *read (const char *in, const char *end, T &value)
+  {
+    if ((size_t) (end - in) < sizeof (T))
+    {
+      return nullptr;
+    }
+    std::memcpy (&value, in, sizeof (T));
+    return in + sizeof (T);
+  }
+};
+
+/**
+ * Strings are encoded as their 64-bit length followed by their characters.
+ */
+template<>
+struct serial_codec<std::string, false>
+{
+  static const uint32_t fixed_size = 0;
+
+  static size_t size (const std::string &value)
+  { return sizeof (uint64_t) + value.size (); }
+
+  static char *write (char *out, const std::string &value)
+  {
+    uint64_t length = value.size ();
+    std::memcpy (out, &length, sizeof (length));
+    std::memcpy (out + sizeof (length), value.data (), value.size ());
+    return out + sizeof (length) + value.size ();
+  }
+
+  static const char *read (const char *in, const char *end,
+                           std::string &value)
+  {
+    uint64_t length;
+    if ((size_t) (end - in) < sizeof (length))
+    {
+      return nullptr;
+    }
+    std::memcpy (&length, in, sizeof (length));
+    in += sizeof (length);
+    if (length > (uint64_t) (end - in))
+    {
+      return nullptr;
+    }
+    value.assign (in, (size_t) length);
+    return in + length;
+  }
+};
+
+template<class KeyT, class ValueT,
+         class TableAllocator = heap_table_allocator>
 class HashMap
 {
   //Typedefs to simplify the code.
-  typedef pair<KeyT,ValueT> item;
+  typedef hash_entry<KeyT,ValueT> item;
   typedef vector<item> bucket;
 
+ public:
+  /**
+   * The changes that turn one map into another.
+   */
+  struct Diff
+  {
+    vector<pair<KeyT,ValueT>> added;
+    vector<KeyT> removed;
+    vector<pair<KeyT,ValueT>> changed;
+
+    bool empty () const
+    {
+      return added.empty () && removed.empty () && changed.empty ();
+    }
+  };
 
   //Map fields
  protected:
   bucket *hash_table;
-  int map_size;
+  size_t map_size;
   double load_factor;
-  int map_capacity;
+  size_t map_capacity;
+  TableAllocator table_allocator;
 
   //Map helper functions
   void update_load_factor ()
@@ -45,36 +462,471 @@ class HashMap
     load_factor = temp;
   }
 
-  int hash_func (const KeyT& key) const
+  size_t hash_func (const KeyT& key) const
   {
     return hash<KeyT> {} (key) & (map_capacity - 1);
   }
 
+  size_t index_of (size_t full_hash) const
+  {
+    return full_hash & (map_capacity - 1);
+  }
+
+  /**
+   * @return The item of the key in the bucket, or nullptr if it isn't there.
+   * @param full_hash - The hash of the key, compared before the keys.
+   */
+  static const item *find_in_bucket (const bucket &curr_bucket,
+                                     const KeyT &key, size_t full_hash)
+  {
+    for (const auto &element : curr_bucket)
+    {
+      if (element.has_hash (full_hash) && element.first == key)
+      {
+        return &element;
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * @return The item of the bucket with the key of probe, or nullptr.
+   */
+  static const item *find_in_bucket (const bucket &curr_bucket,
+                                     const item &probe)
+  {
+    for (const auto &element : curr_bucket)
+    {
+      if (element.same_hash (probe) && element.first == probe.first)
+      {
+        return &element;
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * @return The item of the key, or nullptr if it isn't in the map.
+   */
+  const item *find_item (const KeyT &key) const
+  {
+    return find_item (key, hash<KeyT> {} (key));
+  }
+
+  const item *find_item (const KeyT &key, size_t full_hash) const
+  {
+    if (hash_table == nullptr)
+    {
+      return nullptr;
+    }
+    return find_in_bucket (*(hash_table + index_of (full_hash)), key,
+                           full_hash);
+  }
+
+  /**
+   * Allocates the buckets array on the first insertion, so maps that stay
+   * empty never touch the heap.
+   */
+  void allocate_table ()
+  {
+    if (hash_table == nullptr)
+    {
+      hash_table = new_table (map_capacity);
+    }
+  }
+
+  /**
+   * @return An array of capacity empty buckets, in memory taken from the
+   * table allocator.
+   */
+  bucket *new_table (size_t capacity)
+  {
+    void *memory = table_allocator.allocate (capacity * sizeof (bucket));
+    bucket *table = static_cast<bucket *> (memory);
+    for (size_t i = 0; i < capacity; i++)
+    {
+      new (table + i) bucket ();
+    }
+    return table;
+  }
+
+  void free_table (bucket *table, size_t capacity)
+  {
+    if (table == nullptr)
+    {
+      return;
+    }
+    for (size_t i = 0; i < capacity; i++)
+    {
+      (table + i)->~bucket ();
+    }
+    table_allocator.deallocate (table, capacity * sizeof (bucket));
+  }
+
+  /**
+   * The function rehashes the map by changing its capacity according to
+   * direction and then moves the items to their new buckets. Keys with a
+   * cached hash aren't hashed again.
+   * @param direction - Orders the function if it needs to be increase the
+   * capacity or decrease it.
+   */
+   void rehash_func(const int direction)
+  {
+    size_t old_capacity = map_capacity;
+    change_capacity (direction);
+    relocate_table (old_capacity);
+  }
+
+  /**
+   * Moves the items of the buckets array, of old_capacity buckets, to a new
+   * array of map_capacity buckets.
+   */
+  void relocate_table (size_t old_capacity)
+  {
+    bucket *old_table = hash_table;
+    hash_table = new_table (map_capacity);
+    for (size_t i = 0;i < old_capacity;i++)
+    {
+      for (auto& element : *(old_table + i))
+      {
+        bucket &target = *(hash_table + index_of (element.full_hash ()));
+        target.push_back (std::move (element));
+      }
+    }
+    free_table (old_table, old_capacity);
+    update_load_factor();
+  }
+
+  /**
+   * Erases the item of a key.
+   * @param shrink - Whether the map may shrink right away. Callers that
+   * erase many items in a row pass false and call shrink_if_sparse once
+   * they are done.
+   * @return Whether the key was in the map.
+   */
+  bool remove_item (const KeyT &key, bool shrink)
+  {
+    if (hash_table == nullptr)
+    {
+      return false;
+    }
+    size_t full_hash = hash<KeyT> {} (key);
+    bucket &curr_bucket = *(hash_table + index_of (full_hash));
+    //Iterator on the desired pair<key,value> in the hash map.
+    auto it = std::find_if(curr_bucket.begin(), curr_bucket.end(),
+                           [&key, full_hash](const item& element)
+                           {return element.has_hash (full_hash)
+                                   && element.first == key;});
+    if (it == curr_bucket.end ())
+    {
+      return false;
+    }
+    curr_bucket.erase (it);
+    map_size--;
+    update_load_factor();
+    if (shrink)
+    {
+      shrink_if_sparse ();
+    }
+    return true;
+  }
+
+  /**
+   * Shrinks the map if it is under the lower load factor.
+   */
+  void shrink_if_sparse ()
+  {
+    if (hash_table != nullptr && load_factor < (double) LOWER_LOAD_FACTOR)
+    {
+      rehash_func (DECREASE_HASH);
+    }
+  }
+
+  /**
+   * Shrinks a map that was grown for more keys than it got, e.g. by a bulk
+   * assignment of duplicate keys, to the capacity that adding its keys one
+   * at a time would have reached, but not below min_capacity.
+   */
+  void fit_capacity (size_t min_capacity)
+  {
+    size_t fitted = std::max<size_t> (min_capacity, STARTING_HASH_CAPACITY);
+    while ((double) map_size / fitted > (double) UPPER_LOAD_FACTOR)
+    {
+      fitted *= 2;
+    }
+    if (fitted >= map_capacity)
+    {
+      return;
+    }
+    size_t old_capacity = map_capacity;
+    map_capacity = fitted;
+    if (hash_table != nullptr)
+    {
+      relocate_table (old_capacity);
+    }
+    update_load_factor ();
+  }
+
+  /**
+   * Helper function for diff, compares two buckets with the same index in
+   * maps of equal capacity.
+   */
+  static void diff_buckets (const bucket &from, const bucket &to, Diff &changes)
+  {
+    for (const auto& element : from)
+    {
+      const item *found = find_in_bucket (to, element);
+      if (found == nullptr)
+      {
+        changes.removed.push_back (element.first);
+      }
+      else if (found->second != element.second)
+      {
+        changes.changed.push_back (*found);
+      }
+    }
+    for (const auto& element : to)
+    {
+      if (find_in_bucket (from, element) == nullptr)
+      {
+        changes.added.push_back (element);
+      }
+    }
+  }
+
+  /**
+   * Assigns the items of a range of key/value pairs, one at a time.
+   */
+  template<class PairIterator, class Category>
+  void assign_range (PairIterator begin, const PairIterator &end, Category)
+  {
+    while (begin != end)
+    {
+      operator[] ((*begin).first) = (*begin).second;
+      begin++;
+    }
+  }
+
+  /**
+   * Assigns the items of a random access range of key/value pairs. The map
+   * is grown once up front, and large ranges are split by destination
+   * bucket between threads that each write their own buckets, see
+   * assign_partitioned. Later pairs win over earlier ones with the same key.
+   * The map is grown as if every key were new, then shrunk back, see
+   * fit_capacity, if many were already in it or repeated.
+   */
+  template<class PairIterator>
+  void assign_range (PairIterator begin, const PairIterator &end,
+                     std::random_access_iterator_tag)
+  {
+    auto count = std::distance (begin, end);
+    if (count <= 0)
+    {
+      return;
+    }
+    size_t old_capacity = map_capacity;
+    reserve (map_size + (size_t) count);
+    unsigned threads = std::min<size_t> (std::thread::hardware_concurrency (),
+                                         count / PARALLEL_UPDATE_MIN_ITEMS);
+    if (threads <= 1)
+    {
+      assign_range (begin, end, std::input_iterator_tag ());
+    }
+    else
+    {
+      assign_partitioned (begin, (size_t) count, threads);
+    }
+    fit_capacity (old_capacity);
+  }
+
+  /**
+   * Assigns count pairs starting at begin on the given number of threads,
+   * see the overload below.
+   */
+  template<class PairIterator>
+  void assign_partitioned (const PairIterator &begin, size_t count,
+                           unsigned threads)
+  {
+    assign_partitioned ([&begin] (size_t i) -> const KeyT &
+                        { return begin[i].first; },
+                        [&begin] (size_t i) -> const ValueT &
+                        { return begin[i].second; },
+                        count, threads);
+  }
+
+  /**
+   * Assigns count pairs, the i'th being key_of (i) -> value_of (i), on the
+   * given number of threads. Later pairs win over earlier ones with the
+   * same key. The map must already have room for every pair.
+   * The buckets are split into PARTITIONS_PER_THREAD contiguous ranges per
+   * thread. The keys are hashed in parallel and their indexes are radix
+   * sorted by bucket range, keeping their order within a range. Then the
+   * threads take ranges from a shared counter until none are left, so no
+   * bucket is written by two threads and a thread whose ranges were quick
+   * takes over ranges the others haven't reached.
+   * @param key_array - The keys, if they are contiguous, so that they are
+   * hashed in batches by hash_batch, else nullptr.
+   */
+  template<class KeyOf, class ValueOf>
+  void assign_partitioned (const KeyOf &key_of, const ValueOf &value_of,
+                           size_t count, unsigned threads,
+                           const KeyT *key_array = nullptr)
+  {
+    allocate_table ();
+    if (threads <= 1)
+    {
+      assign_ordered (key_of, value_of, nullptr, nullptr, 0, count);
+      update_load_factor ();
+      return;
+    }
+    size_t ranges = std::min<size_t> ((size_t) threads
+                                      * PARTITIONS_PER_THREAD, map_capacity);
+    vector<size_t> hashes (count);
+    vector<vector<size_t>> offsets (threads, vector<size_t> (ranges + 1));
+    auto chunk_start = [count, threads] (unsigned chunk)
+    { return count * chunk / threads; };
+    auto range_of = [this, ranges] (size_t full_hash)
+    { return (size_t) ((uint64_t) index_of (full_hash) * ranges
+                       / map_capacity); };
+
+    run_on_threads (threads, [&] (unsigned chunk)
+    {
+      for (size_t i = chunk_start (chunk); i < chunk_start (chunk + 1); i++)
+      {
+        if (key_array == nullptr)
+        {
+          hashes[i] = hash<KeyT> {} (key_of (i));
+        }
+        else if ((i - chunk_start (chunk)) % BATCH_LOOKUP_WIDTH == 0)
+        {
+          hash_batch<KeyT>::apply (key_array + i, std::min<size_t> (
+              BATCH_LOOKUP_WIDTH, chunk_start (chunk + 1) - i), &hashes[i]);
+        }
+        offsets[chunk][range_of (hashes[i]) + 1]++;
+      }
+    });
+    //offsets[chunk][range] becomes the position of the chunk's first pair
+    //of that range in order, which is grouped by range and then by chunk.
+    size_t position = 0;
+    vector<size_t> range_starts (ranges + 1);
+    for (size_t range = 0; range < ranges; range++)
+    {
+      range_starts[range] = position;
+      for (unsigned chunk = 0; chunk < threads; chunk++)
+      {
+        size_t range_count = offsets[chunk][range + 1];
+        offsets[chunk][range] = position;
+        position += range_count;
+      }
+    }
+    range_starts[ranges] = position;
+    vector<size_t> order (count);
+    run_on_threads (threads, [&] (unsigned chunk)
+    {
+      for (size_t i = chunk_start (chunk); i < chunk_start (chunk + 1); i++)
+      {
+        order[offsets[chunk][range_of (hashes[i])]++] = i;
+      }
+    });
+
+    vector<size_t> added (threads);
+    std::atomic<size_t> next_range (0);
+    try
+    {
+      run_on_threads (threads, [&] (unsigned thread)
+      {
+        size_t range;
+        while ((range = next_range++) < ranges)
+        {
+          added[thread] += assign_ordered (key_of, value_of, hashes.data (),
+                                           order.data (), range_starts[range],
+                                           range_starts[range + 1]);
+        }
+      });
+    }
+    catch (...)
+    {
+      for (size_t thread_added : added)
+      {
+        map_size += thread_added;
+      }
+      update_load_factor ();
+      throw;
+    }
+    for (size_t thread_added : added)
+    {
+      map_size += thread_added;
+    }
+    update_load_factor ();
+  }
+
   /**
-   * The function rehashes the map by changing its capacity according to
-   * direction and then hashes the items back in to the map.
-   * @param direction - Orders the function if it needs to be increase the
-   * capacity or decrease it.
+   * Assigns the pairs at positions first to last of order, or the pairs
+   * first to last themselves if order is nullptr, see assign_partitioned.
+   * @param hashes - The hash of every key, or nullptr to hash them here.
+   * @return The number of keys added. With order given, the caller adds
+   * them to map_size; without it they are added here.
    */
-   void rehash_func(const int direction)
+  template<class KeyOf, class ValueOf>
+  size_t assign_ordered (const KeyOf &key_of, const ValueOf &value_of,
+                         const size_t *hashes, const size_t *order,
+                         size_t first, size_t last)
   {
-    list<pair<KeyT, ValueT>> temp;
-    for (int i = 0;i < map_capacity;i++)
+    size_t added = 0;
+    for (size_t k = first; k < last; k++)
     {
-      bucket curr_bucket = *(hash_table + i);
-      for (size_t j = 0; j < curr_bucket.size();j++)
+      size_t i = order == nullptr ? k : order[k];
+      const KeyT &key = key_of (i);
+      size_t full_hash = hashes == nullptr ? hash<KeyT> {} (key) : hashes[i];
+      bucket &curr_bucket = *(hash_table + index_of (full_hash));
+      const item *found = find_in_bucket (curr_bucket, key, full_hash);
+      if (found != nullptr)
+      {
+        const_cast<ValueT &> (found->second) = value_of (i);
+      }
+      else
       {
-        temp.push_back (curr_bucket[j]);
+        curr_bucket.emplace_back (key, value_of (i), full_hash);
+        added++;
+        if (order == nullptr)
+        {
+          map_size++;
+        }
       }
     }
-    change_capacity (direction);
-    delete[] hash_table;
-    map_size = EMPTY_HASH;
-    hash_table = new bucket [map_capacity];
-    for (const auto& item : temp)
+    return added;
+  }
+
+  /**
+   * Checks the magic, version, key and value widths of an image header,
+   * and that its item count fits in its payload, throwing runtime_error
+   * (SERIAL_FORMAT_ERROR) if any is wrong.
+   * @return The payload bytes the header claims, not yet checked against
+   * the image.
+   */
+  static uint64_t check_header (const char *data)
+  {
+    typedef serial_codec<KeyT> key_codec;
+    typedef serial_codec<ValueT> value_codec;
+    uint32_t header[4];
+    uint64_t counts[2];
+    std::memcpy (header, data, sizeof (header));
+    std::memcpy (counts, data + sizeof (header), sizeof (counts));
+    //The smallest encoding of an item bounds the count, so a bad count
+    //can't make the map reserve more than the image could hold.
+    uint64_t min_item = (key_codec::fixed_size != 0 ? key_codec::fixed_size
+                                                    : sizeof (uint64_t))
+                        + (value_codec::fixed_size != 0
+                           ? value_codec::fixed_size : sizeof (uint64_t));
+    if (std::memcmp (header, SERIAL_MAGIC, sizeof (uint32_t)) != 0
+        || header[1] != SERIAL_VERSION
+        || header[2] != key_codec::fixed_size
+        || header[3] != value_codec::fixed_size
+        || counts[0] > counts[1] / min_item)
     {
-      this->insert (item.first, item.second);
+      throw std::runtime_error (SERIAL_FORMAT_ERROR);
     }
+    return counts[1];
   }
 
   /**
@@ -109,26 +961,37 @@ class HashMap
  public:
   //Default Constructor
   HashMap ():
-  hash_table (new bucket[STARTING_HASH_CAPACITY]),
+  hash_table (nullptr),
   map_size (EMPTY_HASH),
   load_factor(EMPTY_HASH),
   map_capacity (STARTING_HASH_CAPACITY)
   {};
 
+  /**
+   * Constructs an empty map whose buckets array will be allocated by the
+   * given allocator.
+   */
+  explicit HashMap (const TableAllocator &allocator):
+  hash_table (nullptr),
+  map_size (EMPTY_HASH),
+  load_factor(EMPTY_HASH),
+  map_capacity (STARTING_HASH_CAPACITY),
+  table_allocator (allocator)
+  {};
+
   /**
    * Constructs a hash-table from a vectors of keys and a vectors of values.
    * @param key_vect
    * @param value_vect
    */
   HashMap (const vector<KeyT>& key_vect, const vector<ValueT> &value_vect):
-      hash_table (new bucket[STARTING_HASH_CAPACITY]),
+      hash_table (nullptr),
       map_size (EMPTY_HASH),
       load_factor(EMPTY_HASH),
       map_capacity (STARTING_HASH_CAPACITY)
   {
     if (key_vect.size () != value_vect.size ())
     {
-      delete[] hash_table;
       throw std::length_error (CONSTRUCTOR_ERROR);
     }
     for (size_t i = 0; i < key_vect.size (); i++)
@@ -137,10 +1000,40 @@ class HashMap
     }
   };
 
+  /**
+   * Constructs a hash-table from a vectors of keys and a vectors of values
+   * on several threads, see assign_partitioned. The table is sized once for
+   * all the keys, and shrunk back to the sequential constructor's capacity
+   * if many of them were duplicates. Later keys win over earlier equal
+   * ones, as with the sequential constructor.
+   * @param threads - The threads to build on, 0 for one per hardware thread.
+   */
+  HashMap (parallel_policy, const vector<KeyT>& key_vect,
+           const vector<ValueT> &value_vect, unsigned threads = 0):
+      HashMap ()
+  {
+    if (key_vect.size () != value_vect.size ())
+    {
+      throw std::length_error (CONSTRUCTOR_ERROR);
+    }
+    if (threads == 0)
+    {
+      threads = std::max (1u, std::thread::hardware_concurrency ());
+    }
+    reserve (key_vect.size ());
+    assign_partitioned ([&key_vect] (size_t i) -> const KeyT &
+                        { return key_vect[i]; },
+                        [&value_vect] (size_t i) -> const ValueT &
+                        { return value_vect[i]; },
+                        key_vect.size (), threads, key_vect.data ());
+    fit_capacity (STARTING_HASH_CAPACITY);
+  }
+
 
   HashMap (const HashMap &other):
-      hash_table(new bucket[other.map_capacity]), map_size(EMPTY_HASH),
-      load_factor(other.load_factor), map_capacity(other.map_capacity)
+      hash_table(nullptr), map_size(EMPTY_HASH),
+      load_factor(other.load_factor), map_capacity(other.map_capacity),
+      table_allocator(other.table_allocator)
   {
     for (auto item = other.begin(); item != other.end();item++)
     {
@@ -150,13 +1043,13 @@ class HashMap
 
   virtual ~HashMap ()
   {
-    delete[] hash_table;
+    free_table (hash_table, map_capacity);
   };
 
-  int size () const
+  size_t size () const
   { return map_size; }
 
-  int capacity () const
+  size_t capacity () const
   { return map_capacity; }
 
 
@@ -168,12 +1061,13 @@ class HashMap
 
   bool insert (const KeyT &key,const ValueT &value)
   {
-    if (!contains_key (key))
+    size_t full_hash = hash<KeyT> {} (key);
+    if (find_item (key, full_hash) == nullptr)
     {
       //insert a new pair into the hash_table.
-      int hash_value = hash_func (key);
-      bucket &curr_bucket = *(hash_table + hash_value);
-      curr_bucket.emplace_back (key, value);
+      allocate_table ();
+      bucket &curr_bucket = *(hash_table + index_of (full_hash));
+      curr_bucket.emplace_back (key, value, full_hash);
       curr_bucket.shrink_to_fit();
       map_size++;
       update_load_factor();
@@ -194,24 +1088,18 @@ class HashMap
   */
   virtual bool erase (const KeyT& key)
   {
-    int hash_value = hash_func (key);
-    if (!contains_key (key))
-    {
-      return false;
-    }
-    bucket &curr_bucket = *(hash_table + hash_value);
-    //Iterator on the desired pair<key,value> in the hash map.
-    auto it = std::find_if(curr_bucket.begin(), curr_bucket.end(),
-                           [&key](const item& element)
-                           {return element.first == key;});
-    (hash_table + hash_value)->erase (it);
-    map_size--;
-    update_load_factor();
-    if (load_factor < (double)LOWER_LOAD_FACTOR)
-    {
-      rehash_func(DECREASE_HASH);
-    }
-    return true;
+    return try_erase (key);
+  }
+
+  /**
+   * Erases a value of a given key. Unlike erase it is never overridden, so
+   * it doesn't throw on a missing key through a Dictionary either.
+   * @param key: The key of the desired value the user wants to erase.
+   * @return A bool value whether the key was in the map.
+   */
+  bool try_erase (const KeyT& key)
+  {
+    return remove_item (key, true);
   }
 
   /**
@@ -220,15 +1108,7 @@ class HashMap
    */
   bool contains_key (const KeyT& key) const
   {
-    int hash_value = hash_func (key);
-    for (const auto& item : *(hash_table + hash_value))
-    {
-      if (item.first == key)
-      {
-        return true;
-      }
-    }
-    return false;
+    return find_item (key) != nullptr;
   }
 
   /**
@@ -237,55 +1117,272 @@ class HashMap
    */
   ValueT& at (const KeyT& key)const
   {
-    int hash_value = hash_func (key);
-    for (auto& item : *(hash_table + hash_value))
+    const item *found = find_item (key);
+    if (found == nullptr)
     {
-      if (item.first == key)
-      {
-        return item.second;
-      }
+      throw std::runtime_error (INVALID_KEY_ERROR);
     }
-    throw std::runtime_error (INVALID_KEY_ERROR);
+    return const_cast<ValueT &> (found->second);
   }
 
   ValueT& at (const KeyT& key)
   {
-    int hash_value = hash_func (key);
-    for (auto& item : *(hash_table + hash_value))
+    const item *found = find_item (key);
+    if (found == nullptr)
+    {
+      throw std::runtime_error (INVALID_KEY_ERROR);
+    }
+    return const_cast<ValueT &> (found->second);
+  }
+
+  /**
+   * @param key - The key of the desired value.
+   * @return A pointer to the value of the key, or nullptr if the key isn't
+   * in the map.
+   */
+  const ValueT *find (const KeyT& key) const
+  {
+    const item *found = find_item (key);
+    return found == nullptr ? nullptr : &found->second;
+  }
+
+  ValueT *find (const KeyT& key)
+  {
+    const item *found = find_item (key);
+    return found == nullptr ? nullptr : const_cast<ValueT *> (&found->second);
+  }
+
+  /**
+   * Looks up many keys at once, hiding memory latency by interleaving up to
+   * BATCH_LOOKUP_WIDTH lookups on the calling thread. Each lookup is a small
+   * state machine: it prefetches its bucket and yields, prefetches the
+   * bucket's items and yields, then compares keys and makes room for the
+   * next key. Meanwhile the other lookups make progress, so the cache
+   * misses of the batch overlap instead of adding up. The keys are hashed
+   * BATCH_LOOKUP_WIDTH at a time by hash_batch.
+   * @param keys - The keys to look up.
+   * @param count - The number of keys.
+   * @param results - Set to a pointer to the value of each key, or nullptr
+   * for the keys that aren't in the map.
+   */
+  void find_many (const KeyT *keys, size_t count, const ValueT **results) const
+  {
+    if (hash_table == nullptr)
+    {
+      std::fill (results, results + count, nullptr);
+      return;
+    }
+    struct probe
+    {
+      size_t index;
+      size_t full_hash;
+      const bucket *curr_bucket;
+      bool bucket_ready;
+    };
+    probe probes[BATCH_LOOKUP_WIDTH];
+    //The hashes of the keys from the last multiple of BATCH_LOOKUP_WIDTH
+    //before next, hashed together by hash_batch.
+    size_t hashes[BATCH_LOOKUP_WIDTH];
+    size_t next = 0;
+    int active = 0;
+    auto start = [this, keys, count, &hashes, &next] (probe &curr)
+    {
+      if (next % BATCH_LOOKUP_WIDTH == 0)
+      {
+        hash_batch<KeyT>::apply (keys + next, std::min<size_t> (
+            BATCH_LOOKUP_WIDTH, count - next), hashes);
+      }
+      curr.index = next++;
+      curr.full_hash = hashes[curr.index % BATCH_LOOKUP_WIDTH];
+      curr.curr_bucket = hash_table + index_of (curr.full_hash);
+      curr.bucket_ready = false;
+      __builtin_prefetch (curr.curr_bucket);
+    };
+    while (active < BATCH_LOOKUP_WIDTH && next < count)
+    {
+      start (probes[active++]);
+    }
+    while (active > 0)
     {
-      if (item.first == key)
+      for (int i = 0; i < active;)
       {
-        return item.second;
+        probe &curr = probes[i];
+        if (!curr.bucket_ready)
+        {
+          if (!curr.curr_bucket->empty ())
+          {
+            __builtin_prefetch (curr.curr_bucket->data ());
+          }
+          curr.bucket_ready = true;
+          i++;
+          continue;
+        }
+        const item *found = find_in_bucket (*curr.curr_bucket,
+                                            keys[curr.index], curr.full_hash);
+        results[curr.index] = found == nullptr ? nullptr : &found->second;
+        if (next < count)
+        {
+          start (curr);
+          i++;
+        }
+        else
+        {
+          curr = probes[--active];
+        }
       }
     }
-    throw std::runtime_error (INVALID_KEY_ERROR);
+  }
+
+  /**
+   * @return For every key, a pointer to its value or nullptr, see find_many.
+   */
+  vector<const ValueT *> find_many (const vector<KeyT> &keys) const
+  {
+    vector<const ValueT *> results (keys.size ());
+    find_many (keys.data (), keys.size (), results.data ());
+    return results;
+  }
+
+  /**
+   * @param key - The key of the desired value.
+   * @param default_value - Returned when the key isn't in the map.
+   * @return The value of the key, or default_value.
+   */
+  ValueT get_or (const KeyT& key, const ValueT& default_value) const
+  {
+    const item *found = find_item (key);
+    return found == nullptr ? default_value : found->second;
   }
 
   double get_load_factor () const
   { return load_factor; }
 
+  /**
+   * Moves the items of other into this map without copying keys or values,
+   * and leaves other empty.
+   * @param policy - Whether the value of a key that is in both maps is kept
+   * (KEEP_EXISTING) or taken from other (OVERWRITE_EXISTING).
+   */
+  void merge (HashMap &&other, MergePolicy policy = OVERWRITE_EXISTING)
+  {
+    if (policy == KEEP_EXISTING)
+    {
+      merge (std::move (other), [] (ValueT &, ValueT &&) {});
+    }
+    else
+    {
+      merge (std::move (other), [] (ValueT &existing, ValueT &&incoming)
+      { existing = std::move (incoming); });
+    }
+  }
+
+  /**
+   * Moves the items of other into this map without copying keys or values,
+   * and leaves other empty. If this map is empty and other's buckets array
+   * can be freed by this map's allocator, it takes that array as is.
+   * Otherwise it is first grown to at least other's capacity.
+   * With equal capacities every bucket of other is spliced into the bucket
+   * with the same index, without hashing. The map grows once at the end if
+   * needed.
+   * @param combine - Called as combine(existing, std::move(incoming)) for
+   * a key that is in both maps, to set the merged value in existing.
+   */
+  template<class Combine>
+  void merge (HashMap &&other, Combine combine)
+  {
+    if (this == &other || other.map_size == EMPTY_HASH)
+    {
+      return;
+    }
+    if (map_size == EMPTY_HASH && table_allocator == other.table_allocator)
+    {
+      std::swap (hash_table, other.hash_table);
+      std::swap (map_capacity, other.map_capacity);
+      std::swap (map_size, other.map_size);
+      update_load_factor ();
+      other.update_load_factor ();
+      return;
+    }
+    allocate_table ();
+    if (map_capacity < other.map_capacity)
+    {
+      size_t old_capacity = map_capacity;
+      map_capacity = other.map_capacity;
+      relocate_table (old_capacity);
+    }
+    bool same_index = map_capacity == other.map_capacity;
+    for (size_t i = 0; i < other.map_capacity; i++)
+    {
+      for (auto &element : *(other.hash_table + i))
+      {
+        bucket &target = *(hash_table + (same_index ? i
+                                         : index_of (element.full_hash ())));
+        const item *found = find_in_bucket (target, element);
+        if (found != nullptr)
+        {
+          combine (const_cast<ValueT &> (found->second),
+                   std::move (element.second));
+        }
+        else
+        {
+          target.push_back (std::move (element));
+          map_size++;
+        }
+      }
+    }
+    other.clear ();
+    update_load_factor ();
+    reserve (map_size);
+  }
+
+  /**
+   * Grows the map once so that it holds count items without rehashing.
+   * The capacity doubles until count items fit under the upper load factor.
+   * It never shrinks the map.
+   * @param count - The number of items the map should have room for.
+   */
+  void reserve (size_t count)
+  {
+    size_t new_capacity = map_capacity;
+    while ((double) count / new_capacity > (double) UPPER_LOAD_FACTOR)
+    {
+      new_capacity *= 2;
+    }
+    if (new_capacity == map_capacity)
+    {
+      return;
+    }
+    size_t old_capacity = map_capacity;
+    map_capacity = new_capacity;
+    if (hash_table != nullptr)
+    {
+      relocate_table (old_capacity);
+    }
+    update_load_factor ();
+  }
+
 
   /**
    * @param key: The key the user wishes to get its bucket size.
    * @return The size of the bucket that contains the key.
    */
-  int bucket_size (const KeyT& key) const
+  size_t bucket_size (const KeyT& key) const
   {
-    if (!contains_key (key))
+    const item *found = find_item (key);
+    if (found == nullptr)
     {
       throw std::runtime_error (INVALID_KEY_ERROR);
     }
-    int hash_value = hash_func (key);
-    return (hash_table + hash_value)->size();
+    return (hash_table + hash_func (key))->size();
   }
 
   /**
   * @param key: The key the user wishes to get its bucket index.
   * @return The index of the bucket in the hash-table that contains the key.
   */
-  int bucket_index (const KeyT& key) const
+  size_t bucket_index (const KeyT& key) const
   {
-    if (!contains_key (key))
+    if (find_item (key) == nullptr)
     {
       throw std::runtime_error (INVALID_KEY_ERROR);
     }
@@ -294,15 +1391,201 @@ class HashMap
 
   /**
    * Removes all the items in the hash-table but doesn't change its capacity.
+   * The buckets array is kept and its buckets are emptied in place.
    */
   void clear ()
   {
-    delete[] hash_table;
-    hash_table = new bucket [map_capacity];
+    if (hash_table != nullptr && map_size != EMPTY_HASH)
+    {
+      for (size_t i = 0; i < map_capacity; i++)
+      {
+        (hash_table + i)->clear ();
+      }
+    }
     map_size = EMPTY_HASH;
     update_load_factor();
   }
 
+  /**
+   * Appends an image of the map to buffer. The items are measured first,
+   * so buffer grows once and no byte of it is moved. The image starts with
+   * a header: SERIAL_MAGIC, SERIAL_VERSION, the encoded sizes of a key and
+   * a value (0 for variable sizes), the item count and the bytes of the
+   * items, as 32 and 64 bit numbers. The items follow, each key followed
+   * by its value as encoded by serial_codec, and the CRC-32 of all of the
+   * above ends the image.
+   */
+  void serialize (vector<char> &buffer) const
+  {
+    typedef serial_codec<KeyT> key_codec;
+    typedef serial_codec<ValueT> value_codec;
+    uint64_t payload = 0;
+    if (key_codec::fixed_size != 0 && value_codec::fixed_size != 0)
+    {
+      payload = (uint64_t) map_size
+                * (key_codec::fixed_size + value_codec::fixed_size);
+    }
+    else
+    {
+      for (size_t i = 0; hash_table != nullptr && i < map_capacity; i++)
+      {
+        for (const auto &element : *(hash_table + i))
+        {
+          payload += key_codec::size (element.first)
+                     + value_codec::size (element.second);
+        }
+      }
+    }
+    size_t start = buffer.size ();
+    buffer.resize (start + SERIAL_HEADER_BYTES + payload
+                   + SERIAL_CHECKSUM_BYTES);
+    char *image = buffer.data () + start;
+    uint32_t header[4] = {0, SERIAL_VERSION, key_codec::fixed_size,
+                          value_codec::fixed_size};
+    std::memcpy (header, SERIAL_MAGIC, sizeof (uint32_t));
+    uint64_t counts[2] = {map_size, payload};
+    std::memcpy (image, header, sizeof (header));
+    std::memcpy (image + sizeof (header), counts, sizeof (counts));
+    char *out = image + SERIAL_HEADER_BYTES;
+    for (size_t i = 0; hash_table != nullptr && i < map_capacity; i++)
+    {
+      for (const auto &element : *(hash_table + i))
+      {
+        out = key_codec::write (out, element.first);
+        out = value_codec::write (out, element.second);
+      }
+    }
+    uint32_t checksum = crc32 (image, (size_t) (out - image));
+    std::memcpy (out, &checksum, sizeof (checksum));
+  }
+
+  /**
+   * Writes an image of the map to a stream with a single write, see
+   * serialize (vector<char> &).
+   */
+  void serialize (std::ostream &out) const
+  {
+    vector<char> image;
+    serialize (image);
+    out.write (image.data (), (std::streamsize) image.size ());
+    if (!out)
+    {
+      throw std::runtime_error (SERIAL_WRITE_ERROR);
+    }
+  }
+
+  /**
+   * Replaces the items of the map with those of an image written by
+   * serialize for the same key and value types. The image is checked
+   * before the map is touched, and the map is sized for the item count up
+   * front, growing or shrinking once, so the items are loaded without
+   * rehashing or comparing keys across buckets.
+   * Throws std::runtime_error if the image is cut short, corrupt or of
+   * other types, leaving the map as it was, or empty if the image passed
+   * its checksum but is still malformed.
+   * @param data - The image, possibly followed by other bytes.
+   * @param size - The bytes from data on.
+   * @return The bytes of the image.
+   */
+  size_t deserialize (const char *data, size_t size)
+  {
+    typedef serial_codec<KeyT> key_codec;
+    typedef serial_codec<ValueT> value_codec;
+    uint64_t counts[2];
+    if (size < SERIAL_HEADER_BYTES + SERIAL_CHECKSUM_BYTES)
+    {
+      throw std::runtime_error (SERIAL_FORMAT_ERROR);
+    }
+    check_header (data);
+    std::memcpy (counts, data + 4 * sizeof (uint32_t), sizeof (counts));
+    if (counts[1] > size - SERIAL_HEADER_BYTES - SERIAL_CHECKSUM_BYTES)
+    {
+      throw std::runtime_error (SERIAL_FORMAT_ERROR);
+    }
+    size_t image_size = SERIAL_HEADER_BYTES + (size_t) counts[1];
+    uint32_t checksum;
+    std::memcpy (&checksum, data + image_size, sizeof (checksum));
+    if (crc32 (data, image_size) != checksum)
+    {
+      throw std::runtime_error (SERIAL_FORMAT_ERROR);
+    }
+    //check_header bounded counts[0] by the payload, so reserve can't
+    //overflow. A map grown for more items is shrunk first, so the loaded
+    //map ends up as large as inserting its items one at a time makes it.
+    clear ();
+    fit_capacity (STARTING_HASH_CAPACITY);
+    reserve ((size_t) counts[0]);
+    allocate_table ();
+    const char *in = data + SERIAL_HEADER_BYTES;
+    const char *end = data + image_size;
+    for (uint64_t i = 0; i < counts[0]; i++)
+    {
+      KeyT key;
+      ValueT value;
+      in = key_codec::read (in, end, key);
+      in = in == nullptr ? nullptr : value_codec::read (in, end, value);
+      if (in == nullptr)
+      {
+        break;
+      }
+      size_t full_hash = hash<KeyT> {} (key);
+      bucket &curr_bucket = *(hash_table + index_of (full_hash));
+      if (find_in_bucket (curr_bucket, key, full_hash) != nullptr)
+      {
+        in = nullptr;
+        break;
+      }
+      curr_bucket.emplace_back (std::move (key), std::move (value),
+                                full_hash);
+      map_size++;
+    }
+    update_load_factor ();
+    if (in != end)
+    {
+      clear ();
+      throw std::runtime_error (SERIAL_FORMAT_ERROR);
+    }
+    return image_size + SERIAL_CHECKSUM_BYTES;
+  }
+
+  /**
+   * Reads an image written by serialize from a stream, see
+   * deserialize (const char *, size_t). The header is checked before the
+   * rest is read, and the rest is read in chunks of at most
+   * SERIAL_READ_CHUNK bytes, so a corrupt payload size fails once the
+   * stream runs out rather than allocating what it claims.
+   */
+  void deserialize (std::istream &in)
+  {
+    vector<char> image (SERIAL_HEADER_BYTES);
+    in.read (image.data (), SERIAL_HEADER_BYTES);
+    if (in.gcount () != SERIAL_HEADER_BYTES)
+    {
+      throw std::runtime_error (SERIAL_FORMAT_ERROR);
+    }
+    uint64_t payload = check_header (image.data ());
+    if (payload > (uint64_t) SIZE_MAX - SERIAL_HEADER_BYTES
+                  - SERIAL_CHECKSUM_BYTES)
+    {
+      throw std::runtime_error (SERIAL_FORMAT_ERROR);
+    }
+    size_t image_size = SERIAL_HEADER_BYTES + (size_t) payload
+                        + SERIAL_CHECKSUM_BYTES;
+    while (image.size () < image_size)
+    {
+      size_t chunk = std::min<size_t> (image_size - image.size (),
+                                       SERIAL_READ_CHUNK);
+      size_t start = image.size ();
+      image.resize (start + chunk);
+      in.read (image.data () + start, (std::streamsize) chunk);
+      if (in.gcount () != (std::streamsize) chunk)
+      {
+        throw std::runtime_error (SERIAL_FORMAT_ERROR);
+      }
+    }
+    deserialize (image.data (), image.size ());
+  }
+
   bool operator==(const HashMap& rhs)const
   {
     //Check the basic parameter before iterating over the map.
@@ -310,17 +1593,38 @@ class HashMap
     {
       return false;
     }
-    //Iterate to make sure they also contain the same items.
-    for (const auto& item : rhs)
+    if (map_size == EMPTY_HASH || hash_table == rhs.hash_table)
+    {
+      return true;
+    }
+    //With equal capacities equal keys share a bucket index, so the buckets
+    //can be compared pairwise without hashing any key.
+    if (map_capacity == rhs.map_capacity)
     {
-      try
+      for (size_t i = 0; i < map_capacity; i++)
       {
-        if (at(item.first) != rhs.at (item.first))
+        const bucket &curr_bucket = *(hash_table + i);
+        const bucket &rhs_bucket = *(rhs.hash_table + i);
+        if (curr_bucket.size () != rhs_bucket.size ())
         {
           return false;
         }
+        for (const auto& element : rhs_bucket)
+        {
+          const item *found = find_in_bucket (curr_bucket, element);
+          if (found == nullptr || found->second != element.second)
+          {
+            return false;
+          }
+        }
       }
-      catch (std::runtime_error &err)
+      return true;
+    }
+    //Iterate to make sure they also contain the same items.
+    for (const auto& element : rhs)
+    {
+      const item *found = find_item (element.first);
+      if (found == nullptr || found->second != element.second)
       {
         return false;
       }
@@ -334,15 +1638,71 @@ class HashMap
     return !(operator==(rhs));
   }
 
+  /**
+   * @param other - The map to compare with.
+   * @return The items that are only in other (added), the keys that are
+   * only in this map (removed), and the items whose value differs (changed,
+   * with the value of other).
+   */
+  Diff diff (const HashMap &other) const
+  {
+    Diff changes;
+    if (map_capacity == other.map_capacity && hash_table != nullptr
+        && other.hash_table != nullptr)
+    {
+      for (size_t i = 0; i < map_capacity; i++)
+      {
+        diff_buckets (*(hash_table + i), *(other.hash_table + i), changes);
+      }
+      return changes;
+    }
+    for (const auto& element : *this)
+    {
+      const item *found = other.find_item (element.first);
+      if (found == nullptr)
+      {
+        changes.removed.push_back (element.first);
+      }
+      else if (found->second != element.second)
+      {
+        changes.changed.push_back (*found);
+      }
+    }
+    for (const auto& element : other)
+    {
+      if (find_item (element.first) == nullptr)
+      {
+        changes.added.push_back (element);
+      }
+    }
+    return changes;
+  }
+
+  /**
+   * Applies changes computed by diff to this map.
+   */
+  void apply (const Diff &changes)
+  {
+    for (const auto& key : changes.removed)
+    {
+      HashMap::erase (key);
+    }
+    for (const auto& element : changes.added)
+    {
+      operator[] (element.first) = element.second;
+    }
+    for (const auto& element : changes.changed)
+    {
+      operator[] (element.first) = element.second;
+    }
+  }
+
   ValueT& operator[](const KeyT& key)
   {
-      int hash_value = hash_func (key);
-      for (auto& item : *(hash_table + hash_value))
+      const item *found = find_item (key);
+      if (found != nullptr)
       {
-        if (item.first == key)
-        {
-          return item.second;
-        }
+        return const_cast<ValueT &> (found->second);
       }
       insert (key,ValueT());
       return at (key);
@@ -350,15 +1710,8 @@ class HashMap
 
   ValueT operator[](const KeyT& key)const
   {
-    int hash_value = hash_func (key);
-    for (auto& item : *(hash_table + hash_value))
-    {
-      if (item.first == key)
-      {
-        return item.second;
-      }
-    }
-    return ValueT();
+    const item *found = find_item (key);
+    return found == nullptr ? ValueT() : found->second;
   }
 
   void operator=(const HashMap& rhs)
@@ -367,6 +1720,11 @@ class HashMap
     {
       return;
     }
+    if (map_capacity != rhs.map_capacity)
+    {
+      free_table (hash_table, map_capacity);
+      hash_table = nullptr;
+    }
     this->map_capacity = rhs.map_capacity;
     this->clear();
     update_load_factor();
@@ -396,13 +1754,13 @@ class HashMap
 
    private:
     bucket *hash_map;
-    int capacity;
-    int inner_index;
-    int outer_index;
+    size_t capacity;
+    size_t inner_index;
+    size_t outer_index;
 
    public:
-    ConstIterator (bucket *_hash_table, int _capacity, int
-    _outer_index, int _inner_index):
+    ConstIterator (bucket *_hash_table, size_t _capacity, size_t
+    _outer_index, size_t _inner_index):
         hash_map(_hash_table), capacity(_capacity),
         inner_index (_inner_index),outer_index(_outer_index)
     {}
@@ -411,7 +1769,7 @@ class HashMap
     {
       inner_index++;
       //Need to continue to the next non-empty bucket.
-      if ((size_t) inner_index >=  (*(hash_map +outer_index)).size())
+      if (inner_index >=  (*(hash_map +outer_index)).size())
       {
         outer_index++;
         while (outer_index != capacity && (*(hash_map +outer_index)).empty())
@@ -483,7 +1841,11 @@ class HashMap
 
   const_iterator begin() const
   {
-    int starting_bucket_idx = 0;
+    if (hash_table == nullptr)
+    {
+      return end();
+    }
+    size_t starting_bucket_idx = 0;
 
     while (starting_bucket_idx < map_capacity && (*(hash_table +
                                         starting_bucket_idx)).empty())
@@ -511,6 +1873,17 @@ class HashMap
 
 };
 
+/**
+ * @return The changes that turn the map from into the map to.
+ */
+template<class KeyT, class ValueT, class TableAllocator>
+typename HashMap<KeyT, ValueT, TableAllocator>::Diff
+diff (const HashMap<KeyT, ValueT, TableAllocator> &from,
+      const HashMap<KeyT, ValueT, TableAllocator> &to)
+{
+  return from.diff (to);
+}
+
 #endif //_HASHMAP_HPP_
 
 
@@ -0,0 +1,228 @@
+#ifndef _MULTIDICTIONARY_HPP_
+#define _MULTIDICTIONARY_HPP_
+
+#include "HashMap.hpp"
+#include <string>
+#define MULTI_FIRST_RUN 2
+#define MULTI_MIN_GARBAGE 1024
+
+/**
+ * A dictionary from a string key to any number of string values. All the
+ * values live in one array, and the values of a key sit in one contiguous
+ * run of it, so equal_range scans them like an array, and keys don't each
+ * pay for an allocation of their own. A HashMap maps each key to its run.
+ * A run has room to grow. When it is full it moves to the end of the
+ * array with twice the room, and the space it leaves is reclaimed by
+ * packing the array once half of it is garbage.
+ */
+class MultiDictionary
+{
+  struct value_run
+  {
+    size_t begin;
+    size_t count;
+    size_t reserved;
+  };
+
+  HashMap<std::string, value_run> runs;
+  vector<std::string> values;
+  size_t value_count;
+  size_t garbage;
+
+  /**
+   * Gives the run room for at least one more value.
+   */
+  void grow_run (value_run &run)
+  {
+    if (run.begin + run.reserved == values.size ())
+    {
+      //The last run of the array grows in place.
+      values.resize (run.begin + 2 * run.reserved);
+      run.reserved *= 2;
+      return;
+    }
+    size_t new_begin = values.size ();
+    values.resize (new_begin + 2 * run.reserved);
+    std::move (values.begin () + run.begin,
+               values.begin () + run.begin + run.count,
+               values.begin () + new_begin);
+    release_run (run);
+    run.begin = new_begin;
+    run.reserved *= 2;
+  }
+
+  /**
+   * Frees the strings of a run's slots and counts them as garbage.
+   */
+  void release_run (const value_run &run)
+  {
+    for (size_t i = run.begin; i < run.begin + run.reserved; i++)
+    {
+      std::string ().swap (values[i]);
+    }
+    garbage += run.reserved;
+  }
+
+  /**
+   * Moves every run to a new array with no garbage.
+   * @param leave_room - Whether each run keeps room to double, so runs
+   * that still grow don't refill the array with garbage right away.
+   */
+  void pack (bool leave_room)
+  {
+    vector<std::string> packed;
+    packed.reserve (leave_room ? 2 * value_count : value_count);
+    for (const auto &element : runs)
+    {
+      value_run *run = runs.find (element.first);
+      size_t new_begin = packed.size ();
+      for (size_t i = run->begin; i < run->begin + run->count; i++)
+      {
+        packed.push_back (std::move (values[i]));
+      }
+      size_t reserved = leave_room ? 2 * run->count : run->count;
+      packed.resize (new_begin + reserved);
+      *run = value_run {new_begin, run->count, reserved};
+    }
+    values.swap (packed);
+    garbage = 0;
+  }
+
+  void compact_if_sparse ()
+  {
+    if (garbage > MULTI_MIN_GARBAGE && garbage > values.size () / 2)
+    {
+      pack (true);
+    }
+  }
+
+ public:
+  MultiDictionary (): value_count (0), garbage (0)
+  {}
+
+  /**
+   * Adds key_vect[i] -> value_vect[i] for every i. Keys may repeat.
+   */
+  MultiDictionary (const vector<std::string> &key_vect,
+                   const vector<std::string> &value_vect):
+      MultiDictionary ()
+  {
+    if (key_vect.size () != value_vect.size ())
+    {
+      throw std::length_error (CONSTRUCTOR_ERROR);
+    }
+    for (size_t i = 0; i < key_vect.size (); i++)
+    {
+      insert (key_vect[i], value_vect[i]);
+    }
+  }
+
+  /**
+   * @return The number of values of all the keys.
+   */
+  size_t size () const
+  { return value_count; }
+
+  /**
+   * @return The number of distinct keys.
+   */
+  size_t key_count () const
+  { return runs.size (); }
+
+  bool empty () const
+  { return value_count == 0; }
+
+  bool contains_key (const std::string &key) const
+  { return runs.contains_key (key); }
+
+  /**
+   * Adds a value to the values of a key.
+   */
+  void insert (const std::string &key, const std::string &value)
+  {
+    value_run *run = runs.find (key);
+    if (run == nullptr)
+    {
+      runs.insert (key, value_run {values.size (), 0, MULTI_FIRST_RUN});
+      values.resize (values.size () + MULTI_FIRST_RUN);
+      run = runs.find (key);
+    }
+    else if (run->count == run->reserved)
+    {
+      //Packing leaves every run room to double, so the run only grows if
+      //the array wasn't packed.
+      compact_if_sparse ();
+      if (run->count == run->reserved)
+      {
+        grow_run (*run);
+      }
+    }
+    values[run->begin + run->count++] = value;
+    value_count++;
+  }
+
+  /**
+   * @return The values of a key, in insertion order, as a range of
+   * pointers that stays valid until the dictionary is next written.
+   */
+  pair<const std::string *, const std::string *>
+  equal_range (const std::string &key) const
+  {
+    const value_run *run = runs.find (key);
+    if (run == nullptr)
+    {
+      return pair<const std::string *, const std::string *> (nullptr,
+                                                             nullptr);
+    }
+    const std::string *first = values.data () + run->begin;
+    return pair<const std::string *, const std::string *> (first,
+                                                           first + run->count);
+  }
+
+  /**
+   * @return The number of values of a key.
+   */
+  size_t count (const std::string &key) const
+  {
+    const value_run *run = runs.find (key);
+    return run == nullptr ? 0 : run->count;
+  }
+
+  /**
+   * Erases a key with all of its values.
+   * @return The number of values erased.
+   */
+  size_t erase (const std::string &key)
+  {
+    const value_run *run = runs.find (key);
+    if (run == nullptr)
+    {
+      return 0;
+    }
+    size_t erased = run->count;
+    release_run (*run);
+    runs.erase (key);
+    value_count -= erased;
+    compact_if_sparse ();
+    return erased;
+  }
+
+  /**
+   * Moves every run to a new array with no garbage, each with room for
+   * exactly its values, e.g. once the dictionary is done being written.
+   */
+  void compact ()
+  {
+    pack (false);
+  }
+
+  void clear ()
+  {
+    runs.clear ();
+    vector<std::string> ().swap (values);
+    value_count = 0;
+    garbage = 0;
+  }
+};
+
+#endif //_MULTIDICTIONARY_HPP_
@@ -0,0 +1,147 @@
+#ifndef _NUMAHASHMAP_HPP_
+#define _NUMAHASHMAP_HPP_
+
+#include "HashMap.hpp"
+#include "TableAllocators.hpp"
+#include <memory>
+#define NODE_HASH_MULTIPLIER 0x9E3779B97F4A7C15ULL
+
+/**
+ * A hash-map partitioned into one HashMap shard per NUMA node. Each key
+ * belongs to one node, chosen by a mix of its hash, and each shard's
+ * buckets array is allocated on its node by a numa_table_allocator.
+ * The items themselves are allocated by the thread that inserts them, so
+ * they are node-local when a thread bound to the node writes them, see
+ * run_on_nodes. On a single-node machine the map is a single HashMap.
+ * Like HashMap, it needs external synchronization when written; threads
+ * may write to distinct shards concurrently.
+ */
+template<class KeyT, class ValueT>
+class NumaHashMap
+{
+ public:
+  typedef HashMap<KeyT, ValueT, numa_table_allocator> shard_type;
+
+ private:
+  vector<std::unique_ptr<shard_type>> shards;
+
+ public:
+  /**
+   * @param node_count - The number of shards, one per node of the machine
+   * by default.
+   */
+  explicit NumaHashMap (int node_count = numa_node_count ())
+  {
+    if (node_count < 1)
+    {
+      node_count = 1;
+    }
+    for (int node = 0; node < node_count; node++)
+    {
+      shards.emplace_back (new shard_type (numa_table_allocator (node)));
+    }
+  }
+
+  int node_count () const
+  { return (int) shards.size (); }
+
+  /**
+   * @return The node whose shard holds the key.
+   */
+  int node_of (const KeyT &key) const
+  {
+    uint64_t mixed = (uint64_t) hash<KeyT> {} (key) * NODE_HASH_MULTIPLIER;
+    return (int) ((mixed >> 32) % shards.size ());
+  }
+
+  /**
+   * @return The shard of a node, for operations routed to that node.
+   */
+  shard_type &shard (int node)
+  { return *shards[node]; }
+
+  const shard_type &shard (int node) const
+  { return *shards[node]; }
+
+  /**
+   * Runs task(node, shard(node)) on one new thread per node, each bound to
+   * the CPUs of its node when the system allows it, and waits for them.
+   * The first exception thrown by a task is rethrown.
+   */
+  template<class Task>
+  void run_on_nodes (const Task &task)
+  {
+    vector<std::thread> threads;
+    vector<std::exception_ptr> errors (shards.size ());
+    for (int node = 0; node < node_count (); node++)
+    {
+      threads.emplace_back ([this, &task, &errors, node] ()
+      {
+        bind_thread_to_node (node);
+        try
+        {
+          task (node, shard (node));
+        }
+        catch (...)
+        {
+          errors[node] = std::current_exception ();
+        }
+      });
+    }
+    for (auto &thread : threads)
+    {
+      thread.join ();
+    }
+    for (const auto &error : errors)
+    {
+      if (error)
+      {
+        std::rethrow_exception (error);
+      }
+    }
+  }
+
+  size_t size () const
+  {
+    size_t total = 0;
+    for (const auto &curr_shard : shards)
+    {
+      total += curr_shard->size ();
+    }
+    return total;
+  }
+
+  bool empty () const
+  { return size () == 0; }
+
+  bool insert (const KeyT &key, const ValueT &value)
+  { return shard (node_of (key)).insert (key, value); }
+
+  bool erase (const KeyT &key)
+  { return shard (node_of (key)).erase (key); }
+
+  bool contains_key (const KeyT &key) const
+  { return shard (node_of (key)).contains_key (key); }
+
+  ValueT &at (const KeyT &key)
+  { return shard (node_of (key)).at (key); }
+
+  const ValueT &at (const KeyT &key) const
+  { return shard (node_of (key)).at (key); }
+
+  const ValueT *find (const KeyT &key) const
+  { return shard (node_of (key)).find (key); }
+
+  ValueT &operator[] (const KeyT &key)
+  { return shard (node_of (key))[key]; }
+
+  void clear ()
+  {
+    for (auto &curr_shard : shards)
+    {
+      curr_shard->clear ();
+    }
+  }
+};
+
+#endif //_NUMAHASHMAP_HPP_
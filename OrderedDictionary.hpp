@@ -0,0 +1,644 @@
+#ifndef _ORDEREDDICTIONARY_HPP_
+#define _ORDEREDDICTIONARY_HPP_
+
+#include "Dictionary.hpp"
+#include <climits>
+#define BTREE_MAX_KEYS 64
+
+/**
+ * A B+ tree of distinct strings, kept in sorted order. Leaves hold the
+ * keys, up to BTREE_MAX_KEYS each, and are linked in order, so a scan
+ * walks arrays of keys instead of chasing a pointer per key. Inner nodes
+ * hold separators: every key of children[i] is below keys[i], and every
+ * key of children[i + 1] is at least keys[i].
+ * An erase removes a node once it is empty and merges it with a sibling
+ * when they fit in one node, but doesn't borrow keys, so nodes may stay
+ * less than half full.
+ */
+class BTreeIndex
+{
+  struct node
+  {
+    bool leaf;
+    vector<std::string> keys;
+    vector<std::unique_ptr<node>> children;
+    //The neighbouring leaves, for leaves.
+    node *prev;
+    node *next;
+
+    explicit node (bool _leaf): leaf (_leaf), prev (nullptr), next (nullptr)
+    {}
+
+    bool empty () const
+    { return leaf ? keys.empty () : children.empty (); }
+
+    size_t child_of (const std::string &key) const
+    {
+      return std::upper_bound (keys.begin (), keys.end (), key)
+             - keys.begin ();
+    }
+  };
+
+  std::unique_ptr<node> root;
+  size_t key_count;
+
+  /**
+   * Inserts a key under a node, splitting the node if it overflows.
+   * @return The new right half of the node, with the smallest key of its
+   * subtree in separator, or nullptr if the node didn't split.
+   */
+  std::unique_ptr<node> insert_under (node &curr, const std::string &key,
+                                      std::string &separator, bool &added)
+  {
+    if (curr.leaf)
+    {
+      auto position = std::lower_bound (curr.keys.begin (), curr.keys.end (),
+                                        key);
+      if (position != curr.keys.end () && *position == key)
+      {
+        return nullptr;
+      }
+      curr.keys.insert (position, key);
+      added = true;
+      if (curr.keys.size () <= BTREE_MAX_KEYS)
+      {
+        return nullptr;
+      }
+      std::unique_ptr<node> right (new node (true));
+      size_t middle = curr.keys.size () / 2;
+      right->keys.assign (std::make_move_iterator (curr.keys.begin () + middle),
+                          std::make_move_iterator (curr.keys.end ()));
+      curr.keys.resize (middle);
+      right->next = curr.next;
+      right->prev = &curr;
+      if (curr.next != nullptr)
+      {
+        curr.next->prev = right.get ();
+      }
+      curr.next = right.get ();
+      separator = right->keys.front ();
+      return right;
+    }
+    size_t index = curr.child_of (key);
+    std::string child_separator;
+    std::unique_ptr<node> split = insert_under (*curr.children[index], key,
+                                                child_separator, added);
+    if (!split)
+    {
+      return nullptr;
+    }
+    curr.keys.insert (curr.keys.begin () + index, std::move (child_separator));
+    curr.children.insert (curr.children.begin () + index + 1,
+                          std::move (split));
+    if (curr.children.size () <= BTREE_MAX_KEYS + 1)
+    {
+      return nullptr;
+    }
+    std::unique_ptr<node> right (new node (false));
+    size_t middle = curr.keys.size () / 2;
+    separator = std::move (curr.keys[middle]);
+    right->keys.assign (std::make_move_iterator (curr.keys.begin () + middle
+                                                 + 1),
+                        std::make_move_iterator (curr.keys.end ()));
+    right->children.assign (std::make_move_iterator (curr.children.begin ()
+                                                     + middle + 1),
+                            std::make_move_iterator (curr.children.end ()));
+    curr.keys.resize (middle);
+    curr.children.resize (middle + 1);
+    return right;
+  }
+
+  static void unlink_leaf (node &leaf)
+  {
+    if (leaf.prev != nullptr)
+    {
+      leaf.prev->next = leaf.next;
+    }
+    if (leaf.next != nullptr)
+    {
+      leaf.next->prev = leaf.prev;
+    }
+  }
+
+  /**
+   * Moves the keys and children of parent.children[index + 1] to
+   * parent.children[index] if they fit in one node.
+   */
+  static void merge_children (node &parent, size_t index)
+  {
+    node &left = *parent.children[index];
+    node &right = *parent.children[index + 1];
+    if (left.leaf)
+    {
+      if (left.keys.size () + right.keys.size () > BTREE_MAX_KEYS)
+      {
+        return;
+      }
+      std::move (right.keys.begin (), right.keys.end (),
+                 std::back_inserter (left.keys));
+      unlink_leaf (right);
+    }
+    else
+    {
+      if (left.children.size () + right.children.size () > BTREE_MAX_KEYS + 1)
+      {
+        return;
+      }
+      left.keys.push_back (std::move (parent.keys[index]));
+      std::move (right.keys.begin (), right.keys.end (),
+                 std::back_inserter (left.keys));
+      std::move (right.children.begin (), right.children.end (),
+                 std::back_inserter (left.children));
+    }
+    parent.keys.erase (parent.keys.begin () + index);
+    parent.children.erase (parent.children.begin () + index + 1);
+  }
+
+  /**
+   * Erases a key under a node, then removes or merges the child it was
+   * erased from if it became empty or small.
+   * @return Whether the key was found.
+   */
+  bool erase_under (node &curr, const std::string &key)
+  {
+    if (curr.leaf)
+    {
+      auto position = std::lower_bound (curr.keys.begin (), curr.keys.end (),
+                                        key);
+      if (position == curr.keys.end () || *position != key)
+      {
+        return false;
+      }
+      curr.keys.erase (position);
+      return true;
+    }
+    size_t index = curr.child_of (key);
+    node &child = *curr.children[index];
+    if (!erase_under (child, key))
+    {
+      return false;
+    }
+    if (child.empty ())
+    {
+      if (child.leaf)
+      {
+        unlink_leaf (child);
+      }
+      curr.children.erase (curr.children.begin () + index);
+      if (!curr.keys.empty ())
+      {
+        curr.keys.erase (curr.keys.begin () + (index > 0 ? index - 1 : 0));
+      }
+    }
+    else if (index + 1 < curr.children.size ())
+    {
+      merge_children (curr, index);
+    }
+    else if (index > 0)
+    {
+      merge_children (curr, index - 1);
+    }
+    return true;
+  }
+
+  const node *first_leaf () const
+  {
+    const node *curr = root.get ();
+    while (!curr->leaf)
+    {
+      curr = curr->children.front ().get ();
+    }
+    return curr;
+  }
+
+ public:
+  /**
+   * Iterates the keys in order.
+   */
+  class ConstIterator
+  {
+    friend class BTreeIndex;
+
+   public:
+    typedef std::string value_type;
+    typedef const std::string &reference;
+    typedef const std::string *pointer;
+    typedef std::ptrdiff_t difference_type;
+    typedef std::forward_iterator_tag iterator_category;
+
+   private:
+    const node *leaf;
+    size_t index;
+
+    //Moves past the end of emptied leaves, to the next key or the end.
+    void settle ()
+    {
+      while (leaf != nullptr && index >= leaf->keys.size ())
+      {
+        leaf = leaf->next;
+        index = 0;
+      }
+    }
+
+    ConstIterator (const node *_leaf, size_t _index):
+        leaf (_leaf), index (_index)
+    {
+      settle ();
+    }
+
+   public:
+    ConstIterator &operator++ ()
+    {
+      index++;
+      settle ();
+      return *this;
+    }
+
+    ConstIterator operator++ (int)
+    {
+      ConstIterator it (*this);
+      this->operator++ ();
+      return it;
+    }
+
+    bool operator== (const ConstIterator &rhs) const
+    { return leaf == rhs.leaf && index == rhs.index; }
+
+    bool operator!= (const ConstIterator &rhs) const
+    { return !(operator== (rhs)); }
+
+    reference operator* () const
+    { return leaf->keys[index]; }
+
+    pointer operator-> () const
+    { return &(operator* ()); }
+  };
+
+  using const_iterator = ConstIterator;
+
+  BTreeIndex (): root (new node (true)), key_count (0)
+  {}
+
+  BTreeIndex (const BTreeIndex &other): BTreeIndex ()
+  {
+    for (const auto &key : other)
+    {
+      insert (key);
+    }
+  }
+
+  BTreeIndex &operator= (const BTreeIndex &rhs)
+  {
+    if (this != &rhs)
+    {
+      BTreeIndex copy (rhs);
+      std::swap (root, copy.root);
+      std::swap (key_count, copy.key_count);
+    }
+    return *this;
+  }
+
+  size_t size () const
+  { return key_count; }
+
+  bool empty () const
+  { return key_count == 0; }
+
+  /**
+   * @return Whether the key was added, i.e. wasn't in the index.
+   */
+  bool insert (const std::string &key)
+  {
+    std::string separator;
+    bool added = false;
+    std::unique_ptr<node> split = insert_under (*root, key, separator, added);
+    if (split)
+    {
+      std::unique_ptr<node> new_root (new node (false));
+      new_root->keys.push_back (std::move (separator));
+      new_root->children.push_back (std::move (root));
+      new_root->children.push_back (std::move (split));
+      root = std::move (new_root);
+    }
+    key_count += added;
+    return added;
+  }
+
+  /**
+   * @return Whether the key was in the index.
+   */
+  bool erase (const std::string &key)
+  {
+    if (!erase_under (*root, key))
+    {
+      return false;
+    }
+    key_count--;
+    while (!root->leaf && root->children.size () == 1)
+    {
+      std::unique_ptr<node> child = std::move (root->children.front ());
+      root = std::move (child);
+    }
+    if (!root->leaf && root->children.empty ())
+    {
+      root.reset (new node (true));
+    }
+    return true;
+  }
+
+  void clear ()
+  {
+    root.reset (new node (true));
+    key_count = 0;
+  }
+
+  /**
+   * @return An iterator to the first key that isn't less than key.
+   */
+  const_iterator lower_bound (const std::string &key) const
+  {
+    const node *curr = root.get ();
+    while (!curr->leaf)
+    {
+      curr = curr->children[curr->child_of (key)].get ();
+    }
+    return const_iterator (curr, std::lower_bound (curr->keys.begin (),
+                                                   curr->keys.end (), key)
+                                 - curr->keys.begin ());
+  }
+
+  /**
+   * @return The range of the keys that start with prefix.
+   */
+  pair<const_iterator, const_iterator>
+  prefix_range (const std::string &prefix) const
+  {
+    //The smallest string above every string with the prefix.
+    std::string above = prefix;
+    while (!above.empty () && (unsigned char) above.back () == UCHAR_MAX)
+    {
+      above.pop_back ();
+    }
+    if (above.empty ())
+    {
+      return pair<const_iterator, const_iterator> (lower_bound (prefix),
+                                                   end ());
+    }
+    above.back () = (char) ((unsigned char) above.back () + 1);
+    return pair<const_iterator, const_iterator> (lower_bound (prefix),
+                                                 lower_bound (above));
+  }
+
+  const_iterator begin () const
+  { return const_iterator (first_leaf (), 0); }
+
+  const_iterator end () const
+  { return const_iterator (nullptr, 0); }
+};
+
+/**
+ * A Dictionary with an ordered index of its keys, kept in sync on every
+ * write, for sorted export and range or prefix queries without copying
+ * and sorting the whole dictionary. Lookups by key still go to the hash
+ * table. The index holds its own copy of each key.
+ * The Dictionary is a protected base, so every write goes through this
+ * class and reaches the index; dictionary gives it for reads.
+ */
+class OrderedDictionary: protected Dictionary
+{
+  BTreeIndex index;
+
+  void reindex ()
+  {
+    index.clear ();
+    for (const auto &element : *this)
+    {
+      index.insert (element.first);
+    }
+  }
+
+  /**
+   * Assigns and indexes the pairs of an input range one at a time, since
+   * it can be walked only once.
+   */
+  template<class DictIterator>
+  void update_range (DictIterator begin, const DictIterator &end,
+                     std::input_iterator_tag)
+  {
+    for (; begin != end; ++begin)
+    {
+      (*this)[begin->first] = begin->second;
+    }
+  }
+
+  /**
+   * Assigns a forward range at once, see Dictionary::update, then indexes
+   * its keys.
+   */
+  template<class DictIterator>
+  void update_range (DictIterator begin, const DictIterator &end,
+                     std::forward_iterator_tag)
+  {
+    Dictionary::update (begin, end);
+    for (DictIterator curr = begin; curr != end; ++curr)
+    {
+      index.insert (curr->first);
+    }
+  }
+
+ public:
+  typedef BTreeIndex::const_iterator ordered_iterator;
+  using Dictionary::const_iterator;
+  using Dictionary::Diff;
+
+  OrderedDictionary ()
+  {}
+
+  OrderedDictionary (vector<string> key_vect, vector<string> value_vect):
+      Dictionary (key_vect, value_vect)
+  {
+    for (const auto &key : key_vect)
+    {
+      index.insert (key);
+    }
+  }
+
+  using Dictionary::size;
+  using Dictionary::capacity;
+  using Dictionary::empty;
+  using Dictionary::get_load_factor;
+  using Dictionary::contains_key;
+  using Dictionary::at;
+  using Dictionary::find;
+  using Dictionary::find_many;
+  using Dictionary::get_or;
+  using Dictionary::bucket_size;
+  using Dictionary::bucket_index;
+  using Dictionary::reserve;
+  using Dictionary::serialize;
+  using Dictionary::diff;
+  using Dictionary::begin;
+  using Dictionary::end;
+  using Dictionary::cbegin;
+  using Dictionary::cend;
+  using Dictionary::operator==;
+  using Dictionary::operator!=;
+
+  /**
+   * The dictionary itself, for reads and for passing it on as a Dictionary.
+   */
+  const Dictionary &dictionary () const
+  { return *this; }
+
+  bool operator== (const OrderedDictionary &rhs) const
+  { return dictionary () == rhs.dictionary (); }
+
+  bool operator!= (const OrderedDictionary &rhs) const
+  { return !(*this == rhs); }
+
+  bool insert (const std::string &key, const std::string &value)
+  {
+    if (!Dictionary::insert (key, value))
+    {
+      return false;
+    }
+    index.insert (key);
+    return true;
+  }
+
+  bool erase (const std::string &key) override
+  {
+    Dictionary::erase (key);
+    index.erase (key);
+    return true;
+  }
+
+  bool erase (const std::string &key, const std::nothrow_t &)
+  {
+    return Dictionary::try_erase (key) && index.erase (key);
+  }
+
+  /**
+   * Erases a key without throwing when it is missing.
+   * @return Whether the key was in the dictionary.
+   */
+  bool try_erase (const std::string &key)
+  {
+    return erase (key, std::nothrow);
+  }
+
+  /**
+   * Assigns every key/value pair of a range, later pairs winning over
+   * earlier ones, see Dictionary::update. An input range is assigned a
+   * pair at a time.
+   */
+  template<class DictIterator>
+  void update (DictIterator begin, const DictIterator &end)
+  {
+    update_range (begin, end,
+                  typename std::iterator_traits<DictIterator>::
+                  iterator_category ());
+  }
+
+  void merge (HashMap &&other, MergePolicy policy = OVERWRITE_EXISTING)
+  {
+    for (const auto &element : other)
+    {
+      index.insert (element.first);
+    }
+    Dictionary::merge (std::move (other), policy);
+  }
+
+  void apply (const Diff &changes)
+  {
+    Dictionary::apply (changes);
+    for (const auto &key : changes.removed)
+    {
+      index.erase (key);
+    }
+    for (const auto &element : changes.added)
+    {
+      index.insert (element.first);
+    }
+  }
+
+  void clear ()
+  {
+    Dictionary::clear ();
+    index.clear ();
+  }
+
+  /**
+   * Loads an image written by serialize and indexes its keys.
+   */
+  size_t deserialize (const char *data, size_t size)
+  {
+    size_t image_size;
+    try
+    {
+      image_size = Dictionary::deserialize (data, size);
+    }
+    catch (std::runtime_error &)
+    {
+      reindex ();
+      throw;
+    }
+    reindex ();
+    return image_size;
+  }
+
+  void deserialize (std::istream &in)
+  {
+    try
+    {
+      Dictionary::deserialize (in);
+    }
+    catch (std::runtime_error &)
+    {
+      reindex ();
+      throw;
+    }
+    reindex ();
+  }
+
+  std::string &operator[] (const std::string &key)
+  {
+    std::string *found = find (key);
+    if (found != nullptr)
+    {
+      return *found;
+    }
+    insert (key, std::string ());
+    return *find (key);
+  }
+
+  std::string operator[] (const std::string &key) const
+  {
+    return get_or (key, std::string ());
+  }
+
+  /**
+   * @return The keys in order; values are looked up with at.
+   */
+  ordered_iterator ordered_begin () const
+  { return index.begin (); }
+
+  ordered_iterator ordered_end () const
+  { return index.end (); }
+
+  /**
+   * @return An iterator to the first key, in order, that isn't less than
+   * key.
+   */
+  ordered_iterator lower_bound (const std::string &key) const
+  { return index.lower_bound (key); }
+
+  /**
+   * @return The range of the keys that start with prefix, in order.
+   */
+  pair<ordered_iterator, ordered_iterator>
+  prefix_range (const std::string &prefix) const
+  { return index.prefix_range (prefix); }
+};
+
+#endif //_ORDEREDDICTIONARY_HPP_
@@ -0,0 +1,552 @@
+#ifndef _PERSISTENTHASHMAP_HPP_
+#define _PERSISTENTHASHMAP_HPP_
+
+#include "HashMap.hpp"
+#include <cstdint>
+#include <memory>
+#define HAMT_BITS 5
+#define HAMT_MASK ((1 << HAMT_BITS) - 1)
+#define HAMT_HASH_BITS (8 * sizeof (size_t))
+
+/**
+ * An immutable hash-map implemented as a hash array mapped trie.
+ * Every level of the trie consumes HAMT_BITS bits of the key's hash, and a
+ * node keeps a bitmap of its inline items and a bitmap of its child nodes,
+ * so it stores only the slots in use.
+ * insert, set and erase don't change the map, they return a new version
+ * that shares every node but the O(log32 n) nodes on the path to the key.
+ * Keys whose whole hashes collide share a collision node at the bottom of
+ * the trie.
+ */
+template<class KeyT, class ValueT>
+class PersistentHashMap
+{
+  //Typedefs to simplify the code.
+  typedef pair<KeyT,ValueT> item;
+  struct node;
+  typedef std::shared_ptr<const node> node_ptr;
+
+  struct node
+  {
+    uint32_t item_map = 0;
+    uint32_t child_map = 0;
+    vector<item> items;
+    vector<node_ptr> children;
+  };
+
+  //Map fields
+  node_ptr root;
+  size_t map_size;
+
+  PersistentHashMap (node_ptr _root, size_t _size):
+      root (std::move (_root)), map_size (_size)
+  {}
+
+  static size_t hash_func (const KeyT &key)
+  {
+    return hash<KeyT> {} (key);
+  }
+
+  static uint32_t bit_of (size_t hash_value, unsigned shift)
+  {
+    return (uint32_t) 1 << ((hash_value >> shift) & HAMT_MASK);
+  }
+
+  //The position of the slot of bit among the slots marked in the bitmap.
+  static int index_of (uint32_t bitmap, uint32_t bit)
+  {
+    return __builtin_popcount (bitmap & (bit - 1));
+  }
+
+  /**
+   * Builds the smallest sub-trie holding two items whose hashes agree on
+   * the bits consumed above shift.
+   */
+  static node_ptr merge_items (item first, size_t first_hash, item second,
+                               size_t second_hash, unsigned shift)
+  {
+    auto merged = std::make_shared<node> ();
+    if (shift >= HAMT_HASH_BITS)
+    {
+      merged->items.push_back (std::move (first));
+      merged->items.push_back (std::move (second));
+      return merged;
+    }
+    uint32_t first_bit = bit_of (first_hash, shift);
+    uint32_t second_bit = bit_of (second_hash, shift);
+    if (first_bit == second_bit)
+    {
+      merged->child_map = first_bit;
+      merged->children.push_back (
+          merge_items (std::move (first), first_hash, std::move (second),
+                       second_hash, shift + HAMT_BITS));
+      return merged;
+    }
+    merged->item_map = first_bit | second_bit;
+    if (first_bit < second_bit)
+    {
+      merged->items.push_back (std::move (first));
+      merged->items.push_back (std::move (second));
+    }
+    else
+    {
+      merged->items.push_back (std::move (second));
+      merged->items.push_back (std::move (first));
+    }
+    return merged;
+  }
+
+  static const item *find_item (const node *curr, const KeyT &key,
+                                size_t hash_value)
+  {
+    unsigned shift = 0;
+    while (curr != nullptr)
+    {
+      if (shift >= HAMT_HASH_BITS)
+      {
+        for (const auto &element : curr->items)
+        {
+          if (element.first == key)
+          {
+            return &element;
+          }
+        }
+        return nullptr;
+      }
+      uint32_t bit = bit_of (hash_value, shift);
+      if (curr->item_map & bit)
+      {
+        const item &element = curr->items[index_of (curr->item_map, bit)];
+        return element.first == key ? &element : nullptr;
+      }
+      if (!(curr->child_map & bit))
+      {
+        return nullptr;
+      }
+      curr = curr->children[index_of (curr->child_map, bit)].get ();
+      shift += HAMT_BITS;
+    }
+    return nullptr;
+  }
+
+  /**
+   * Returns a copy of the sub-trie with the item added, or with its value
+   * replaced when the key exists and overwrite is set. Returns curr itself
+   * when nothing changes.
+   * @param added - Set to true if the key wasn't in the sub-trie.
+   */
+  static node_ptr insert_item (const node_ptr &curr, const KeyT &key,
+                               const ValueT &value, size_t hash_value,
+                               unsigned shift, bool overwrite, bool &added)
+  {
+    if (shift >= HAMT_HASH_BITS)
+    {
+      for (size_t i = 0; i < curr->items.size (); i++)
+      {
+        if (curr->items[i].first == key)
+        {
+          if (!overwrite)
+          {
+            return curr;
+          }
+          auto copy = std::make_shared<node> (*curr);
+          copy->items[i].second = value;
+          return copy;
+        }
+      }
+      auto copy = std::make_shared<node> (*curr);
+      copy->items.emplace_back (key, value);
+      added = true;
+      return copy;
+    }
+    uint32_t bit = bit_of (hash_value, shift);
+    if (curr->item_map & bit)
+    {
+      int index = index_of (curr->item_map, bit);
+      const item &existing = curr->items[index];
+      if (existing.first == key)
+      {
+        if (!overwrite)
+        {
+          return curr;
+        }
+        auto copy = std::make_shared<node> (*curr);
+        copy->items[index].second = value;
+        return copy;
+      }
+      //Push both items one level down.
+      auto copy = std::make_shared<node> (*curr);
+      node_ptr child = merge_items (existing, hash_func (existing.first),
+                                    item (key, value), hash_value,
+                                    shift + HAMT_BITS);
+      copy->items.erase (copy->items.begin () + index);
+      copy->item_map ^= bit;
+      copy->child_map |= bit;
+      copy->children.insert (copy->children.begin ()
+                             + index_of (copy->child_map, bit), child);
+      added = true;
+      return copy;
+    }
+    if (curr->child_map & bit)
+    {
+      int index = index_of (curr->child_map, bit);
+      node_ptr child = insert_item (curr->children[index], key, value,
+                                    hash_value, shift + HAMT_BITS, overwrite,
+                                    added);
+      if (child == curr->children[index])
+      {
+        return curr;
+      }
+      auto copy = std::make_shared<node> (*curr);
+      copy->children[index] = child;
+      return copy;
+    }
+    auto copy = std::make_shared<node> (*curr);
+    copy->item_map |= bit;
+    copy->items.insert (copy->items.begin () + index_of (copy->item_map, bit),
+                        item (key, value));
+    added = true;
+    return copy;
+  }
+
+  /**
+   * Returns a copy of the sub-trie without the key, or curr itself if the
+   * key isn't in it. An empty sub-trie is returned as nullptr.
+   */
+  static node_ptr erase_item (const node_ptr &curr, const KeyT &key,
+                              size_t hash_value, unsigned shift)
+  {
+    if (shift >= HAMT_HASH_BITS)
+    {
+      for (size_t i = 0; i < curr->items.size (); i++)
+      {
+        if (curr->items[i].first == key)
+        {
+          if (curr->items.size () == 1)
+          {
+            return nullptr;
+          }
+          auto copy = std::make_shared<node> (*curr);
+          copy->items.erase (copy->items.begin () + i);
+          return copy;
+        }
+      }
+      return curr;
+    }
+    uint32_t bit = bit_of (hash_value, shift);
+    if (curr->item_map & bit)
+    {
+      int index = index_of (curr->item_map, bit);
+      if (!(curr->items[index].first == key))
+      {
+        return curr;
+      }
+      if (curr->items.size () == 1 && curr->children.empty ())
+      {
+        return nullptr;
+      }
+      auto copy = std::make_shared<node> (*curr);
+      copy->items.erase (copy->items.begin () + index);
+      copy->item_map ^= bit;
+      return copy;
+    }
+    if (!(curr->child_map & bit))
+    {
+      return curr;
+    }
+    int index = index_of (curr->child_map, bit);
+    const node_ptr &old_child = curr->children[index];
+    node_ptr child = erase_item (old_child, key, hash_value,
+                                 shift + HAMT_BITS);
+    if (child == old_child)
+    {
+      return curr;
+    }
+    auto copy = std::make_shared<node> (*curr);
+    if (child == nullptr)
+    {
+      copy->children.erase (copy->children.begin () + index);
+      copy->child_map ^= bit;
+      if (copy->items.empty () && copy->children.empty ())
+      {
+        return nullptr;
+      }
+    }
+    else if (child->children.empty () && child->items.size () == 1)
+    {
+      //Pull a lone item back up so equal maps keep equal shapes.
+      copy->children.erase (copy->children.begin () + index);
+      copy->child_map ^= bit;
+      copy->item_map |= bit;
+      copy->items.insert (copy->items.begin ()
+                          + index_of (copy->item_map, bit), child->items[0]);
+    }
+    else
+    {
+      copy->children[index] = child;
+    }
+    return copy;
+  }
+
+ public:
+  //Default Constructor
+  PersistentHashMap ():
+      root (nullptr), map_size (EMPTY_HASH)
+  {}
+
+  /**
+   * Constructs a map from a vectors of keys and a vectors of values. For
+   * repeated keys the last value wins.
+   * @param key_vect
+   * @param value_vect
+   */
+  PersistentHashMap (const vector<KeyT> &key_vect,
+                     const vector<ValueT> &value_vect):
+      PersistentHashMap ()
+  {
+    if (key_vect.size () != value_vect.size ())
+    {
+      throw std::length_error (CONSTRUCTOR_ERROR);
+    }
+    for (size_t i = 0; i < key_vect.size (); i++)
+    {
+      *this = set (key_vect[i], value_vect[i]);
+    }
+  }
+
+  /**
+   * Constructs a version holding the items of a HashMap (or a Dictionary).
+   */
+  explicit PersistentHashMap (const HashMap<KeyT, ValueT> &other):
+      PersistentHashMap ()
+  {
+    for (const auto &element : other)
+    {
+      *this = set (element.first, element.second);
+    }
+  }
+
+  size_t size () const
+  { return map_size; }
+
+  bool empty () const
+  { return (map_size == 0); }
+
+  bool contains_key (const KeyT &key) const
+  {
+    return find_item (root.get (), key, hash_func (key)) != nullptr;
+  }
+
+  /**
+   * @param key - The key of the desired value.
+   * @return the value of the key in this version.
+   */
+  const ValueT &at (const KeyT &key) const
+  {
+    const item *found = find_item (root.get (), key, hash_func (key));
+    if (found == nullptr)
+    {
+      throw std::runtime_error (INVALID_KEY_ERROR);
+    }
+    return found->second;
+  }
+
+  ValueT operator[] (const KeyT &key) const
+  {
+    const item *found = find_item (root.get (), key, hash_func (key));
+    return found == nullptr ? ValueT () : found->second;
+  }
+
+  /**
+   * @return A version with the item added. Like HashMap::insert, an
+   * existing key keeps its value, and this version is returned as is.
+   */
+  PersistentHashMap insert (const KeyT &key, const ValueT &value) const
+  {
+    return with_item (key, value, false);
+  }
+
+  /**
+   * @return A version where the key maps to value, added or replaced.
+   */
+  PersistentHashMap set (const KeyT &key, const ValueT &value) const
+  {
+    return with_item (key, value, true);
+  }
+
+  /**
+   * @return A version without the key. If the key doesn't exist this
+   * version is returned as is.
+   */
+  PersistentHashMap erase (const KeyT &key) const
+  {
+    if (root == nullptr)
+    {
+      return *this;
+    }
+    node_ptr new_root = erase_item (root, key, hash_func (key), 0);
+    if (new_root == root)
+    {
+      return *this;
+    }
+    return PersistentHashMap (new_root, map_size - 1);
+  }
+
+  bool operator== (const PersistentHashMap &rhs) const
+  {
+    if (map_size != rhs.map_size)
+    {
+      return false;
+    }
+    if (root == rhs.root)
+    {
+      return true;
+    }
+    for (const auto &element : rhs)
+    {
+      const item *found = find_item (root.get (), element.first,
+                                     hash_func (element.first));
+      if (found == nullptr || found->second != element.second)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool operator!= (const PersistentHashMap &rhs) const
+  {
+    return !(operator== (rhs));
+  }
+
+  class ConstIterator
+  {
+    friend class PersistentHashMap;
+
+   public:
+    typedef pair<KeyT, ValueT> value_type;
+    typedef const value_type &reference;
+    typedef const value_type *pointer;
+    typedef std::ptrdiff_t difference_type;
+    typedef std::forward_iterator_tag iterator_category;
+
+   private:
+    //A frame is a node and the index of the next slot to visit in it,
+    //counting its items first and then its children.
+    vector<pair<const node *, size_t>> path;
+
+    //Descends until the top frame points at an item, or the path empties.
+    void settle ()
+    {
+      while (!path.empty ())
+      {
+        const node *curr = path.back ().first;
+        size_t index = path.back ().second;
+        if (index < curr->items.size ())
+        {
+          return;
+        }
+        size_t child = index - curr->items.size ();
+        if (child < curr->children.size ())
+        {
+          path.back ().second++;
+          path.emplace_back (curr->children[child].get (), 0);
+        }
+        else
+        {
+          path.pop_back ();
+        }
+      }
+    }
+
+   public:
+    explicit ConstIterator (const node *root)
+    {
+      if (root != nullptr)
+      {
+        path.emplace_back (root, 0);
+        settle ();
+      }
+    }
+
+    ConstIterator &operator++ ()
+    {
+      path.back ().second++;
+      settle ();
+      return *this;
+    }
+
+    ConstIterator operator++ (int)
+    {
+      ConstIterator it (*this);
+      this->operator++ ();
+      return it;
+    }
+
+    bool operator== (const ConstIterator &rhs) const
+    {
+      return path == rhs.path;
+    }
+
+    bool operator!= (const ConstIterator &rhs) const
+    {
+      return !(operator== (rhs));
+    }
+
+    reference operator* () const
+    {
+      return path.back ().first->items[path.back ().second];
+    }
+
+    pointer operator-> () const
+    {
+      return &(operator* ());
+    }
+  };
+
+  using const_iterator = ConstIterator;
+
+  const_iterator begin () const
+  {
+    return const_iterator (root.get ());
+  }
+
+  const_iterator cbegin () const
+  {
+    return begin ();
+  }
+
+  const_iterator end () const
+  {
+    return const_iterator (nullptr);
+  }
+
+  const_iterator cend () const
+  {
+    return end ();
+  }
+
+ private:
+  PersistentHashMap with_item (const KeyT &key, const ValueT &value,
+                               bool overwrite) const
+  {
+    size_t hash_value = hash_func (key);
+    if (root == nullptr)
+    {
+      auto new_root = std::make_shared<node> ();
+      new_root->item_map = bit_of (hash_value, 0);
+      new_root->items.emplace_back (key, value);
+      return PersistentHashMap (new_root, 1);
+    }
+    bool added = false;
+    node_ptr new_root = insert_item (root, key, value, hash_value, 0,
+                                     overwrite, added);
+    if (new_root == root)
+    {
+      return *this;
+    }
+    return PersistentHashMap (new_root, map_size + (added ? 1 : 0));
+  }
+};
+
+#endif //_PERSISTENTHASHMAP_HPP_
@@ -0,0 +1,305 @@
+#ifndef _STRINGPOOL_HPP_
+#define _STRINGPOOL_HPP_
+
+#include "HashMap.hpp"
+#include <deque>
+#include <string>
+#define POOL_FULL_ERROR "ERROR: the string pool ran out of handles."
+
+/**
+ * A handle to a string in a StringPool.
+ */
+typedef uint32_t string_handle;
+
+/**
+ * A reference to a string, hashed and compared by the string's content,
+ * so the pool can index its strings without storing them twice.
+ */
+struct pooled_string
+{
+  const std::string *text;
+
+  bool operator== (const pooled_string &other) const
+  { return *text == *other.text; }
+};
+
+namespace std
+{
+template<>
+struct hash<pooled_string>
+{
+  size_t operator() (const pooled_string &key) const
+  { return hash<std::string> {} (*key.text); }
+};
+}
+
+/**
+ * @return The bytes a string takes outside of its own object, which is
+ * none for strings short enough to be stored inline.
+ */
+inline size_t string_heap_bytes (const std::string &text)
+{
+  return text.capacity () > std::string ().capacity () ? text.capacity () + 1
+                                                       : 0;
+}
+
+/**
+ * Stores each distinct string once and names it by a 32-bit handle.
+ * Strings are never removed, and references to them stay valid for the
+ * life of the pool.
+ */
+class StringPool
+{
+  std::deque<std::string> strings;
+  HashMap<pooled_string, string_handle> handles;
+  size_t string_bytes;
+
+ public:
+  StringPool (): string_bytes (0)
+  {}
+
+  StringPool (const StringPool &) = delete;
+  StringPool &operator= (const StringPool &) = delete;
+
+  /**
+   * @return The handle of the string, adding it to the pool if needed.
+   */
+  string_handle intern (const std::string &text)
+  {
+    const string_handle *found = handles.find (pooled_string {&text});
+    if (found != nullptr)
+    {
+      return *found;
+    }
+    if (strings.size () > UINT32_MAX)
+    {
+      throw std::length_error (POOL_FULL_ERROR);
+    }
+    strings.push_back (text);
+    string_bytes += sizeof (std::string) + string_heap_bytes (strings.back ());
+    string_handle handle = (string_handle) (strings.size () - 1);
+    handles.insert (pooled_string {&strings.back ()}, handle);
+    return handle;
+  }
+
+  /**
+   * Looks up a string without adding it.
+   * @return Whether the string is in the pool, with its handle in handle.
+   */
+  bool find (const std::string &text, string_handle &handle) const
+  {
+    const string_handle *found = handles.find (pooled_string {&text});
+    if (found == nullptr)
+    {
+      return false;
+    }
+    handle = *found;
+    return true;
+  }
+
+  /**
+   * @return The string of a handle returned by intern.
+   */
+  const std::string &operator[] (string_handle handle) const
+  { return strings[handle]; }
+
+  /**
+   * @return The number of distinct strings.
+   */
+  size_t size () const
+  { return strings.size (); }
+
+  /**
+   * @return The bytes taken by the strings and the pool's index of them.
+   */
+  size_t memory_bytes () const
+  {
+    return string_bytes
+           + handles.capacity () * sizeof (vector<int>)
+           + handles.size () * (sizeof (pooled_string)
+                                + sizeof (string_handle));
+  }
+};
+
+/**
+ * The memory an InterningDictionary saves by interning.
+ */
+struct InterningStats
+{
+  size_t entries;
+  //Distinct strings in the pool, shared with other dictionaries if any.
+  size_t distinct_strings;
+  //Bytes the interned strings of the entries would take if each entry had
+  //its own copies.
+  size_t unpooled_bytes;
+  //Bytes the handles of the entries take, and the bytes of the pool.
+  size_t handle_bytes;
+  size_t pool_bytes;
+
+  double dedup_ratio () const
+  {
+    return distinct_strings == 0 ? 0 : (double) entries / distinct_strings;
+  }
+};
+
+/**
+ * A string to string dictionary whose values, and with InternKeys also
+ * keys, are stored once in a StringPool. The table keeps 32-bit handles,
+ * which saves memory when values repeat heavily, e.g. status strings or
+ * country codes. A pool may be shared by several dictionaries.
+ * @tparam InternKeys - Whether keys are interned too. Worth it when the
+ * same keys appear in many dictionaries sharing a pool.
+ */
+template<bool InternKeys = false>
+class InterningDictionary
+{
+  typedef typename std::conditional<InternKeys, string_handle,
+                                    std::string>::type key_type;
+
+  std::shared_ptr<StringPool> pool;
+  HashMap<key_type, string_handle> table;
+  size_t unpooled_bytes;
+
+  typedef std::integral_constant<bool, InternKeys> interns_keys;
+
+  const string_handle *find_handle (const std::string &key,
+                                    std::false_type) const
+  { return table.find (key); }
+
+  const string_handle *find_handle (const std::string &key,
+                                    std::true_type) const
+  {
+    string_handle stored;
+    return pool->find (key, stored) ? table.find (stored) : nullptr;
+  }
+
+  const std::string &table_key (const std::string &key, std::false_type)
+  { return key; }
+
+  string_handle table_key (const std::string &key, std::true_type)
+  { return pool->intern (key); }
+
+  /**
+   * @return The bytes an entry would take with its own copies of the
+   * strings that are interned.
+   */
+  static size_t unpooled_size (const std::string &key,
+                               const std::string &value)
+  {
+    size_t bytes = sizeof (std::string) + string_heap_bytes (value);
+    if (InternKeys)
+    {
+      bytes += sizeof (std::string) + string_heap_bytes (key);
+    }
+    return bytes;
+  }
+
+  const string_handle *find_handle (const std::string &key) const
+  { return find_handle (key, interns_keys ()); }
+
+ public:
+  /**
+   * @param _pool - The pool the strings are interned into, a new one by
+   * default.
+   */
+  explicit InterningDictionary (std::shared_ptr<StringPool> _pool
+                                = std::make_shared<StringPool> ()):
+      pool (std::move (_pool)), unpooled_bytes (0)
+  {}
+
+  size_t size () const
+  { return table.size (); }
+
+  bool empty () const
+  { return table.empty (); }
+
+  const StringPool &string_pool () const
+  { return *pool; }
+
+  /**
+   * @return Whether the key was inserted, i.e. wasn't in the dictionary.
+   */
+  bool insert (const std::string &key, const std::string &value)
+  {
+    if (find_handle (key) != nullptr)
+    {
+      return false;
+    }
+    table.insert (table_key (key, interns_keys ()), pool->intern (value));
+    unpooled_bytes += unpooled_size (key, value);
+    return true;
+  }
+
+  /**
+   * Sets the value of a key, inserting the key if needed.
+   */
+  void set (const std::string &key, const std::string &value)
+  {
+    string_handle *found = const_cast<string_handle *> (find_handle (key));
+    if (found == nullptr)
+    {
+      insert (key, value);
+      return;
+    }
+    unpooled_bytes -= unpooled_size (key, (*pool)[*found]);
+    *found = pool->intern (value);
+    unpooled_bytes += unpooled_size (key, value);
+  }
+
+  bool contains_key (const std::string &key) const
+  { return find_handle (key) != nullptr; }
+
+  /**
+   * @return A pointer to the value of the key, valid as long as the pool,
+   * or nullptr if the key isn't in the dictionary.
+   */
+  const std::string *find (const std::string &key) const
+  {
+    const string_handle *found = find_handle (key);
+    return found == nullptr ? nullptr : &(*pool)[*found];
+  }
+
+  /**
+   * @return The value of the key, a reference into the pool that stays
+   * valid as long as the pool. A missing key throws runtime_error, as
+   * HashMap::at does.
+   */
+  const std::string &at (const std::string &key) const
+  {
+    const std::string *found = find (key);
+    if (found == nullptr)
+    {
+      throw std::runtime_error (INVALID_KEY_ERROR);
+    }
+    return *found;
+  }
+
+  /**
+   * Erases a key. Its strings stay in the pool.
+   * @return Whether the key was in the dictionary.
+   */
+  bool erase (const std::string &key)
+  {
+    const string_handle *found = find_handle (key);
+    if (found == nullptr)
+    {
+      return false;
+    }
+    unpooled_bytes -= unpooled_size (key, (*pool)[*found]);
+    return table.try_erase (table_key (key, interns_keys ()));
+  }
+
+  InterningStats stats () const
+  {
+    InterningStats result;
+    result.entries = size ();
+    result.distinct_strings = pool->size ();
+    result.unpooled_bytes = unpooled_bytes;
+    result.handle_bytes = size () * sizeof (string_handle)
+                          * (InternKeys ? 2 : 1);
+    result.pool_bytes = pool->memory_bytes ();
+    return result;
+  }
+};
+
+#endif //_STRINGPOOL_HPP_
@@ -0,0 +1,389 @@
+#ifndef _STRIPEDHASHMAP_HPP_
+#define _STRIPEDHASHMAP_HPP_
+
+#include "HashMap.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#define LOCK_STRIPES 64
+#define CACHE_LINE_BYTES 64
+
+/**
+ * A hash-map that many threads may read and write at once. The buckets
+ * are split into stripes by the low bits of their index, and each stripe
+ * has its own read/write lock. Lookups and updates of existing keys lock
+ * one stripe, shared or exclusively, so threads on different stripes never
+ * wait for each other. Insertions and erasures that keep the load factor
+ * within its bounds lock one stripe too; only those that would rehash lock
+ * every stripe, in order. The map never has fewer buckets than stripes, so
+ * the keys of a bucket always share its stripe.
+ * Values are copied out rather than referenced, since a reference would
+ * outlive the lock.
+ */
+template<class KeyT, class ValueT>
+class StripedHashMap: protected HashMap<KeyT, ValueT>
+{
+  typedef HashMap<KeyT, ValueT> base;
+  typedef std::shared_timed_mutex rw_lock;
+  typedef std::shared_lock<rw_lock> read_guard;
+  typedef std::unique_lock<rw_lock> write_guard;
+
+  //A lock alone on its cache line, so threads taking neighbouring stripes
+  //don't contend for the line.
+  struct alignas (CACHE_LINE_BYTES) stripe
+  {
+    rw_lock lock;
+  };
+
+  //Destroys and frees the stripes allocated by the constructor, which new
+  //can't align to a cache line before C++17.
+  struct stripe_deleter
+  {
+    size_t count;
+
+    void operator() (stripe *array) const
+    {
+      for (size_t i = 0; i < count; i++)
+      {
+        array[i].~stripe ();
+      }
+      free (array);
+    }
+  };
+
+  /**
+   * Holds every stripe locked, taken in order so two holders can't
+   * deadlock, for operations on the whole table.
+   */
+  class table_guard
+  {
+    const StripedHashMap &map;
+    bool exclusive;
+
+   public:
+    table_guard (const StripedHashMap &_map, bool _exclusive):
+        map (_map), exclusive (_exclusive)
+    {
+      for (size_t i = 0; i < map.stripe_count (); i++)
+      {
+        if (exclusive)
+        {
+          map.stripes[i].lock.lock ();
+        }
+        else
+        {
+          map.stripes[i].lock.lock_shared ();
+        }
+      }
+    }
+
+    ~table_guard ()
+    {
+      for (size_t i = map.stripe_count (); i > 0; i--)
+      {
+        if (exclusive)
+        {
+          map.stripes[i - 1].lock.unlock ();
+        }
+        else
+        {
+          map.stripes[i - 1].lock.unlock_shared ();
+        }
+      }
+    }
+  };
+
+  std::unique_ptr<stripe[], stripe_deleter> stripes;
+  size_t stripe_mask;
+  //The item count, kept apart from the base map's while single stripes
+  //are written.
+  std::atomic<size_t> item_count;
+
+  rw_lock &stripe_of (size_t full_hash) const
+  { return stripes[full_hash & stripe_mask].lock; }
+
+  /**
+   * Claims a change of one item to the item count if the change needs no
+   * rehash. Called with a stripe locked, so the capacity is stable.
+   * @return Whether the change was claimed.
+   */
+  bool claim_count (bool growing)
+  {
+    size_t count = item_count.load ();
+    while (true)
+    {
+      if (!growing && count == 0)
+      {
+        return false;
+      }
+      size_t next = growing ? count + 1 : count - 1;
+      double load = (double) next / this->map_capacity;
+      if (growing ? load > (double) UPPER_LOAD_FACTOR
+                  : load < (double) LOWER_LOAD_FACTOR
+                    && this->map_capacity > stripe_count ())
+      {
+        return false;
+      }
+      if (item_count.compare_exchange_weak (count, next))
+      {
+        return true;
+      }
+    }
+  }
+
+  /**
+   * Runs a base map operation that may rehash, with every stripe locked
+   * exclusively, and grows the map back to one bucket per stripe if it
+   * shrank below that.
+   */
+  template<class Operation>
+  bool restructure (const Operation &operation)
+  {
+    table_guard table (*this, true);
+    this->map_size = item_count.load ();
+    this->update_load_factor ();
+    bool result = operation ();
+    if (this->map_capacity < stripe_count ())
+    {
+      size_t old_capacity = this->map_capacity;
+      this->map_capacity = stripe_count ();
+      this->relocate_table (old_capacity);
+    }
+    item_count.store (this->map_size);
+    return result;
+  }
+
+ public:
+  /**
+   * @param stripe_count - The number of locks, rounded up to a power of
+   * two.
+   */
+  explicit StripedHashMap (size_t stripe_count = LOCK_STRIPES):
+      item_count (0)
+  {
+    size_t rounded = 1;
+    while (rounded < stripe_count)
+    {
+      rounded *= 2;
+    }
+    void *memory = nullptr;
+    if (posix_memalign (&memory, CACHE_LINE_BYTES, rounded * sizeof (stripe))
+        != 0)
+    {
+      throw std::bad_alloc ();
+    }
+    stripe *array = static_cast<stripe *> (memory);
+    stripes = std::unique_ptr<stripe[], stripe_deleter> (
+        array, stripe_deleter {0});
+    for (size_t i = 0; i < rounded; i++)
+    {
+      new (array + i) stripe ();
+      stripes.get_deleter ().count++;
+    }
+    stripe_mask = rounded - 1;
+    this->map_capacity = std::max (this->map_capacity, rounded);
+    this->update_load_factor ();
+    this->allocate_table ();
+  }
+
+  size_t size () const
+  { return item_count.load (); }
+
+  bool empty () const
+  { return size () == 0; }
+
+  size_t stripe_count () const
+  { return stripe_mask + 1; }
+
+  /**
+   * @return Whether the key was inserted, i.e. wasn't in the map.
+   */
+  bool insert (const KeyT &key, const ValueT &value)
+  {
+    size_t full_hash = hash<KeyT> {} (key);
+    {
+      write_guard guard (stripe_of (full_hash));
+      if (claim_count (true))
+      {
+        auto &curr_bucket = *(this->hash_table + this->index_of (full_hash));
+        if (base::find_in_bucket (curr_bucket, key, full_hash) != nullptr)
+        {
+          item_count--;
+          return false;
+        }
+        curr_bucket.emplace_back (key, value, full_hash);
+        return true;
+      }
+    }
+    return restructure ([&] { return base::insert (key, value); });
+  }
+
+  /**
+   * @return Whether the key was in the map.
+   */
+  bool erase (const KeyT &key)
+  {
+    size_t full_hash = hash<KeyT> {} (key);
+    {
+      write_guard guard (stripe_of (full_hash));
+      if (claim_count (false))
+      {
+        auto &curr_bucket = *(this->hash_table + this->index_of (full_hash));
+        auto found = std::find_if (curr_bucket.begin (), curr_bucket.end (),
+                                   [&key, full_hash] (const auto &element)
+                                   { return element.has_hash (full_hash)
+                                            && element.first == key; });
+        if (found == curr_bucket.end ())
+        {
+          item_count++;
+          return false;
+        }
+        curr_bucket.erase (found);
+        return true;
+      }
+    }
+    return restructure ([&] { return base::try_erase (key); });
+  }
+
+  /**
+   * Calls update on the value of a key, if the key is in the map, with its
+   * stripe locked exclusively. update must not use the map.
+   * @return Whether the key was in the map.
+   */
+  template<class Update>
+  bool update_if_present (const KeyT &key, const Update &update)
+  {
+    size_t full_hash = hash<KeyT> {} (key);
+    write_guard guard (stripe_of (full_hash));
+    const auto *found = this->find_item (key, full_hash);
+    if (found == nullptr)
+    {
+      return false;
+    }
+    update (const_cast<ValueT &> (found->second));
+    return true;
+  }
+
+  /**
+   * Calls visit on the value of a key, if the key is in the map, with its
+   * stripe locked shared, so other threads may visit the same value at
+   * once. visit must not use the map, and may only change parts of the
+   * value that are safe to change concurrently, e.g. atomics.
+   * @return Whether the key was in the map.
+   */
+  template<class Visit>
+  bool visit_if_present (const KeyT &key, const Visit &visit) const
+  {
+    size_t full_hash = hash<KeyT> {} (key);
+    read_guard guard (stripe_of (full_hash));
+    const auto *found = this->find_item (key, full_hash);
+    if (found == nullptr)
+    {
+      return false;
+    }
+    visit (found->second);
+    return true;
+  }
+
+  /**
+   * Calls update on the value of a key, or inserts the key with value if
+   * it isn't in the map.
+   * @return Whether the key was inserted.
+   */
+  template<class Update>
+  bool insert_or_update (const KeyT &key, const ValueT &value,
+                         const Update &update)
+  {
+    //Another thread may insert or erase the key in between, so retry.
+    while (true)
+    {
+      if (update_if_present (key, update))
+      {
+        return false;
+      }
+      if (insert (key, value))
+      {
+        return true;
+      }
+    }
+  }
+
+  /**
+   * Copies the value of a key to value.
+   * @return Whether the key was in the map.
+   */
+  bool get (const KeyT &key, ValueT &value) const
+  {
+    size_t full_hash = hash<KeyT> {} (key);
+    read_guard guard (stripe_of (full_hash));
+    const auto *found = this->find_item (key, full_hash);
+    if (found == nullptr)
+    {
+      return false;
+    }
+    value = found->second;
+    return true;
+  }
+
+  ValueT get_or (const KeyT &key, const ValueT &default_value) const
+  {
+    ValueT value;
+    return get (key, value) ? value : default_value;
+  }
+
+  bool contains_key (const KeyT &key) const
+  {
+    size_t full_hash = hash<KeyT> {} (key);
+    read_guard guard (stripe_of (full_hash));
+    return this->find_item (key, full_hash) != nullptr;
+  }
+
+  /**
+   * Grows the map once so that it holds count items without rehashing.
+   */
+  void reserve (size_t count)
+  {
+    table_guard table (*this, true);
+    base::reserve (count);
+  }
+
+  void clear ()
+  {
+    table_guard table (*this, true);
+    base::clear ();
+    item_count.store (0);
+  }
+
+  /**
+   * Calls visit (key, value) on every item, with every stripe locked
+   * shared. visit must not use the map.
+   */
+  template<class Visit>
+  void for_each (const Visit &visit) const
+  {
+    table_guard table (*this, false);
+    for (size_t i = 0; i < this->map_capacity; i++)
+    {
+      for (const auto &element : *(this->hash_table + i))
+      {
+        visit (element.first, element.second);
+      }
+    }
+  }
+
+  /**
+   * @return A copy of the map, taken with every stripe locked shared.
+   */
+  HashMap<KeyT, ValueT> snapshot () const
+  {
+    HashMap<KeyT, ValueT> copy;
+    copy.reserve (size ());
+    for_each ([&copy] (const KeyT &key, const ValueT &value)
+              { copy.insert (key, value); });
+    return copy;
+  }
+};
+
+#endif //_STRIPEDHASHMAP_HPP_
@@ -0,0 +1,233 @@
+#ifndef _TABLEALLOCATORS_HPP_
+#define _TABLEALLOCATORS_HPP_
+
+#include "HashMap.hpp"
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#define NUMA_MPOL_PREFERRED 1
+#define NUMA_MAX_MASK_NODES 64
+#define NUMA_NODES_ONLINE "/sys/devices/system/node/online"
+#define NUMA_NODE_DIRECTORY "/sys/devices/system/node/node"
+#define MMAP_TABLE_MIN_BYTES 4096
+#define HUGE_PAGE_BYTES (2 * 1024 * 1024)
+
+/**
+ * Parses a kernel id list such as "0-3,8,10-11".
+ * @return The ids in the list, in order.
+ */
+inline vector<int> parse_id_list (const std::string &text)
+{
+  vector<int> ids;
+  std::istringstream stream (text);
+  std::string range;
+  while (std::getline (stream, range, ','))
+  {
+    size_t dash = range.find ('-');
+    try
+    {
+      int first = std::stoi (range.substr (0, dash));
+      int last = dash == std::string::npos
+                 ? first : std::stoi (range.substr (dash + 1));
+      for (int id = first; id <= last; id++)
+      {
+        ids.push_back (id);
+      }
+    }
+    catch (std::exception &err)
+    {
+      //Blank or malformed ranges are skipped.
+    }
+  }
+  return ids;
+}
+
+/**
+ * @return The number of NUMA nodes of the machine, or 1 when the system
+ * doesn't report any.
+ */
+inline int numa_node_count ()
+{
+  std::ifstream online (NUMA_NODES_ONLINE);
+  std::string text;
+  if (!std::getline (online, text))
+  {
+    return 1;
+  }
+  vector<int> nodes = parse_id_list (text);
+  return nodes.empty () ? 1 : nodes.back () + 1;
+}
+
+/**
+ * Restricts the calling thread to the CPUs of a NUMA node.
+ * @return Whether the thread was bound.
+ */
+inline bool bind_thread_to_node (int node)
+{
+#ifdef __linux__
+  std::ifstream cpulist (NUMA_NODE_DIRECTORY + std::to_string (node)
+                         + "/cpulist");
+  std::string text;
+  if (!std::getline (cpulist, text))
+  {
+    return false;
+  }
+  cpu_set_t cpus;
+  CPU_ZERO (&cpus);
+  for (int cpu : parse_id_list (text))
+  {
+    if (cpu < CPU_SETSIZE)
+    {
+      CPU_SET (cpu, &cpus);
+    }
+  }
+  return CPU_COUNT (&cpus) > 0
+         && sched_setaffinity (0, sizeof (cpus), &cpus) == 0;
+#else
+  (void) node;
+  return false;
+#endif
+}
+
+/**
+ * Allocates HashMap buckets arrays on a given NUMA node. Arrays of at least
+ * MMAP_TABLE_MIN_BYTES are mapped with mmap and given a preferred-node
+ * policy with mbind, so their pages are placed on the node when they are
+ * first touched. Smaller arrays, systems without mbind and kernels or
+ * containers that refuse it fall back to memory placed by the kernel's
+ * default policy.
+ */
+class numa_table_allocator
+{
+  int node;
+
+ public:
+  explicit numa_table_allocator (int _node = 0): node (_node)
+  {}
+
+  int get_node () const
+  { return node; }
+
+  void *allocate (size_t bytes)
+  {
+#ifdef __linux__
+    if (bytes >= MMAP_TABLE_MIN_BYTES)
+    {
+      void *table = mmap (nullptr, bytes, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (table == MAP_FAILED)
+      {
+        throw std::bad_alloc ();
+      }
+      if (node >= 0 && node < NUMA_MAX_MASK_NODES)
+      {
+        unsigned long mask = 1UL << node;
+        //Best effort, the memory is usable whether it succeeds or not.
+        syscall (SYS_mbind, table, bytes, NUMA_MPOL_PREFERRED, &mask,
+                 NUMA_MAX_MASK_NODES, 0);
+      }
+      return table;
+    }
+#endif
+    return ::operator new (bytes);
+  }
+
+  void deallocate (void *table, size_t bytes)
+  {
+#ifdef __linux__
+    if (bytes >= MMAP_TABLE_MIN_BYTES)
+    {
+      munmap (table, bytes);
+      return;
+    }
+#endif
+    ::operator delete (table);
+  }
+
+  bool operator== (const numa_table_allocator &other) const
+  {
+    return node == other.node;
+  }
+};
+
+/**
+ * Backs buckets arrays of at least one huge page with huge pages, so
+ * random bucket accesses in very large maps miss the TLB less. It first
+ * tries explicit huge pages (MAP_HUGETLB), which need pages reserved in
+ * vm.nr_hugepages. It then falls back to a huge-page-aligned mapping
+ * advised with MADV_HUGEPAGE for transparent huge pages, and finally to
+ * plain memory. Smaller arrays use the heap.
+ */
+class hugepage_table_allocator
+{
+  static size_t mapped_bytes (size_t bytes)
+  {
+    return (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+  }
+
+ public:
+  void *allocate (size_t bytes)
+  {
+#ifdef __linux__
+    if (bytes >= HUGE_PAGE_BYTES)
+    {
+      size_t length = mapped_bytes (bytes);
+#ifdef MAP_HUGETLB
+      void *table = mmap (nullptr, length, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (table != MAP_FAILED)
+      {
+        return table;
+      }
+#endif
+      //Over-map by one huge page and trim it so the start is aligned.
+      void *mapping = mmap (nullptr, length + HUGE_PAGE_BYTES,
+                            PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (mapping == MAP_FAILED)
+      {
+        throw std::bad_alloc ();
+      }
+      uintptr_t start = (uintptr_t) mapping;
+      uintptr_t aligned = (start + HUGE_PAGE_BYTES - 1)
+                          / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+      if (aligned > start)
+      {
+        munmap (mapping, aligned - start);
+      }
+      munmap ((void *) (aligned + length), start + HUGE_PAGE_BYTES - aligned);
+#ifdef MADV_HUGEPAGE
+      madvise ((void *) aligned, length, MADV_HUGEPAGE);
+#endif
+      return (void *) aligned;
+    }
+#endif
+    return ::operator new (bytes);
+  }
+
+  void deallocate (void *table, size_t bytes)
+  {
+#ifdef __linux__
+    if (bytes >= HUGE_PAGE_BYTES)
+    {
+      munmap (table, mapped_bytes (bytes));
+      return;
+    }
+#endif
+    ::operator delete (table);
+  }
+
+  bool operator== (const hugepage_table_allocator &) const
+  {
+    return true;
+  }
+};
+
+#endif //_TABLEALLOCATORS_HPP_
@@ -0,0 +1,1494 @@
+//
+// Micro-benchmarks for HashMap and Dictionary.
+// Usage: Bench [benchmark_name] [scale]
+// Without arguments every benchmark runs once at scale 1. The scale
+// multiplies the element count of each benchmark.
+//
+
+#include "HashMap.hpp"
+#include "Dictionary.hpp"
+#include "CowHashMap.hpp"
+#include "PersistentHashMap.hpp"
+#include "NumaHashMap.hpp"
+#include "FilteredDictionary.hpp"
+#include "BoundedCache.hpp"
+#include "ExpiringHashMap.hpp"
+#include "MultiDictionary.hpp"
+#include "StringPool.hpp"
+#include "OrderedDictionary.hpp"
+#include "DurableDictionary.hpp"
+#include "StripedHashMap.hpp"
+#include "CounterMap.hpp"
+#include "BufferedDictionary.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <malloc.h>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#define DEFAULT_SCALE 1
+#define CYCLES 1000000
+#define MAP_ITEMS 100000
+#define WRITES 1000000
+#define VERSIONS 100
+#define MEMORY_BUDGET (1ULL << 30)
+#define BYTES_PER_SMALL_ITEM 80
+#define ZIPF_EXPONENT 0.99
+#define CACHE_THREADS 4
+#define SWEEP_BUCKETS 64
+#define TAGS 10000
+#define SCALE_TARGET_ITEMS 3000000000ULL
+#define HEAP_CHECK_INTERVAL (1 << 20)
+#define SYNCED_WRITES 2000
+#define GROUP_COMMIT_RECORDS 64
+#define HOT_KEY_THREADS 8
+#define VOCABULARY 50000
+#define PARALLEL_BUILD_BUDGET (3ULL << 30)
+#define HASH_BATCH_SMALL 4096
+#define HASH_BATCH_LARGE (1 << 24)
+
+using std::cout;
+using std::endl;
+
+typedef std::chrono::steady_clock bench_clock;
+
+static size_t scale = DEFAULT_SCALE;
+
+//Keeps the optimizer from discarding benchmark results.
+static volatile size_t sink;
+
+double seconds_since (const bench_clock::time_point &start)
+{
+  return std::chrono::duration<double> (bench_clock::now () - start).count ();
+}
+
+void report (const std::string &name, size_t ops, double seconds)
+{
+  cout << "  " << std::left << std::setw (40) << name << std::right
+       << std::setw (10) << std::fixed << std::setprecision (1)
+       << seconds * 1e9 / ops << " ns/op" << endl;
+}
+
+//Bytes currently allocated on the heap, as reported by glibc.
+size_t heap_in_use ()
+{
+  struct mallinfo2 info = mallinfo2 ();
+  return info.uordblks + info.hblkhd;
+}
+
+void report_memory (const std::string &name, size_t bytes)
+{
+  cout << "  " << std::left << std::setw (40) << name << std::right
+       << std::setw (10) << std::fixed << std::setprecision (1)
+       << bytes / (1024.0 * 1024.0) << " MiB" << endl;
+}
+
+//A string key that opts out of the cached hash, as a baseline.
+struct uncached_key
+{
+  std::string value;
+  bool operator== (const uncached_key &other) const
+  {
+    return value == other.value;
+  }
+};
+
+namespace std
+{
+template<>
+struct hash<uncached_key>
+{
+  size_t operator() (const uncached_key &key) const
+  {
+    return hash<string> {} (key.value);
+  }
+};
+}
+
+template<>
+struct cache_hash_code<uncached_key> : std::false_type
+{};
+
+/**
+ * Construct / insert-one / destroy cycles, and clear-and-refill cycles on a
+ * map that already owns a large table.
+ */
+void bench_construct_cycles ()
+{
+  size_t cycles = CYCLES * scale;
+  auto start = bench_clock::now ();
+  for (size_t i = 0; i < cycles; i++)
+  {
+    HashMap<int, int> map;
+    sink = sink + map.size ();
+  }
+  report ("construct/destroy", cycles, seconds_since (start));
+
+  start = bench_clock::now ();
+  for (size_t i = 0; i < cycles; i++)
+  {
+    HashMap<int, int> map;
+    map.insert ((int) i, (int) i);
+    sink = sink + map.size ();
+  }
+  report ("construct/insert-one/destroy", cycles, seconds_since (start));
+
+  HashMap<int, int> big;
+  for (int i = 0; i < 1 << 16; i++)
+  {
+    big.insert (i, i);
+  }
+  size_t clears = cycles / 100;
+  start = bench_clock::now ();
+  for (size_t i = 0; i < clears; i++)
+  {
+    big.clear ();
+    big.insert ((int) i, (int) i);
+  }
+  report ("clear/insert-one (cap 2^17)", clears, seconds_since (start));
+}
+
+/**
+ * Writer throughput while a consistent snapshot is taken every
+ * `period` writes and held until the next one. Dictionary snapshots are
+ * full copies, CowDictionary snapshots share the unchanged buckets.
+ */
+template<class MapT, class SnapT>
+void bench_snapshot_period (const std::string &name, int period,
+                            SnapT (*take) (const MapT &))
+{
+  size_t items = MAP_ITEMS * scale;
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < items; i++)
+  {
+    keys.push_back ("key:" + std::to_string (i));
+  }
+  MapT map;
+  for (const auto &key: keys)
+  {
+    map[key] = key;
+  }
+  size_t writes = WRITES * scale / 10;
+  std::vector<SnapT> held;
+  auto start = bench_clock::now ();
+  for (size_t i = 0; i < writes; i++)
+  {
+    if (period > 0 && i % period == 0)
+    {
+      held.clear ();
+      held.push_back (take (map));
+    }
+    map[keys[(i * 7919) % items]] = "value";
+  }
+  sink = sink + held.size ();
+  report (name + " every " + (period > 0 ? std::to_string (period)
+                                        : std::string ("never")),
+          writes, seconds_since (start));
+}
+
+Dictionary copy_snapshot (const Dictionary &map)
+{
+  return map;
+}
+
+CowDictionary::Snapshot cow_snapshot (const CowDictionary &map)
+{
+  return map.snapshot ();
+}
+
+void bench_snapshots ()
+{
+  for (int period : {0, 100000, 10000, 1000, 100})
+  {
+    bench_snapshot_period<CowDictionary, CowDictionary::Snapshot>
+        ("CowDictionary snapshot", period, cow_snapshot);
+  }
+  for (int period : {0, 100000, 10000})
+  {
+    bench_snapshot_period<Dictionary, Dictionary>
+        ("Dictionary copy", period, copy_snapshot);
+  }
+}
+
+/**
+ * Keeps VERSIONS historical versions of a map, each one differing from the
+ * previous one by a single changed value, as full HashMap copies and as
+ * PersistentHashMap versions.
+ */
+void bench_versions ()
+{
+  size_t items = MAP_ITEMS * scale;
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < items; i++)
+  {
+    keys.push_back ("key:" + std::to_string (i));
+  }
+
+  size_t heap_before = heap_in_use ();
+  auto start = bench_clock::now ();
+  std::vector<Dictionary> copies (1);
+  for (const auto &key: keys)
+  {
+    copies.back ()[key] = key;
+  }
+  for (int i = 1; i < VERSIONS; i++)
+  {
+    copies.push_back (copies.back ());
+    copies.back ()[keys[(i * 7919) % items]] = "changed";
+  }
+  report ("Dictionary copies per version", VERSIONS, seconds_since (start));
+  report_memory ("Dictionary copies heap", heap_in_use () - heap_before);
+  copies.clear ();
+
+  heap_before = heap_in_use ();
+  start = bench_clock::now ();
+  std::vector<PersistentHashMap<std::string, std::string>> versions (1);
+  for (const auto &key: keys)
+  {
+    versions.back () = versions.back ().set (key, key);
+  }
+  for (int i = 1; i < VERSIONS; i++)
+  {
+    versions.push_back (versions.back ().set (keys[(i * 7919) % items],
+                                              "changed"));
+  }
+  report ("PersistentHashMap per version", VERSIONS, seconds_since (start));
+  report_memory ("PersistentHashMap heap", heap_in_use () - heap_before);
+
+  const auto &latest = versions.back ();
+  start = bench_clock::now ();
+  for (size_t i = 0; i < items; i++)
+  {
+    sink = sink + latest.at (keys[(i * 7919) % items]).size ();
+  }
+  report ("PersistentHashMap at", items, seconds_since (start));
+  Dictionary flat;
+  for (const auto &key: keys)
+  {
+    flat[key] = key;
+  }
+  start = bench_clock::now ();
+  for (size_t i = 0; i < items; i++)
+  {
+    sink = sink + flat.at (keys[(i * 7919) % items]).size ();
+  }
+  report ("Dictionary at", items, seconds_since (start));
+}
+
+/**
+ * operator== and diff on equal 100k-entry Dictionaries, with equal and
+ * with different capacities.
+ */
+void bench_equality ()
+{
+  size_t items = MAP_ITEMS * scale;
+  Dictionary a, b, c;
+  for (size_t i = 0; i < 4 * items; i++)
+  {
+    c["key:" + std::to_string (i)];
+  }
+  c.clear ();
+  for (size_t i = 0; i < items; i++)
+  {
+    std::string key = "key:" + std::to_string (i);
+    a[key] = b[key] = c[key] = key;
+  }
+  int rounds = 20;
+  auto start = bench_clock::now ();
+  for (int i = 0; i < rounds; i++)
+  {
+    sink = sink + (a == b);
+  }
+  report ("operator== equal capacity", rounds * items, seconds_since (start));
+  start = bench_clock::now ();
+  for (int i = 0; i < rounds; i++)
+  {
+    sink = sink + (a == c);
+  }
+  report ("operator== different capacity", rounds * items,
+          seconds_since (start));
+  start = bench_clock::now ();
+  for (int i = 0; i < rounds; i++)
+  {
+    sink = sink + diff (a, b).changed.size ();
+  }
+  report ("diff equal capacity", rounds * items, seconds_since (start));
+}
+
+/**
+ * Lookups at a 50% miss rate through the throwing and the non-throwing API.
+ */
+void bench_miss_lookup ()
+{
+  size_t items = MAP_ITEMS * scale;
+  Dictionary map;
+  std::vector<std::string> probes;
+  for (size_t i = 0; i < items; i++)
+  {
+    map["key:" + std::to_string (i)] = "value";
+    probes.push_back ((i % 2 ? "key:" : "miss:") + std::to_string (i));
+  }
+  auto start = bench_clock::now ();
+  for (const auto &probe: probes)
+  {
+    try
+    {
+      sink = sink + map.at (probe).size ();
+    }
+    catch (std::runtime_error &err)
+    {
+      sink = sink + 1;
+    }
+  }
+  report ("at + catch", items, seconds_since (start));
+  start = bench_clock::now ();
+  for (const auto &probe: probes)
+  {
+    const std::string *value = map.find (probe);
+    sink = sink + (value == nullptr ? 1 : value->size ());
+  }
+  report ("find", items, seconds_since (start));
+  const std::string fallback;
+  start = bench_clock::now ();
+  for (const auto &probe: probes)
+  {
+    sink = sink + map.get_or (probe, fallback).size ();
+  }
+  report ("get_or", items, seconds_since (start));
+
+  Dictionary erased (map);
+  start = bench_clock::now ();
+  for (const auto &probe: probes)
+  {
+    try
+    {
+      sink = sink + erased.erase (probe);
+    }
+    catch (InvalidKey &err)
+    {
+      sink = sink + 1;
+    }
+  }
+  report ("Dictionary::erase + catch", items, seconds_since (start));
+  erased = map;
+  start = bench_clock::now ();
+  for (const auto &probe: probes)
+  {
+    sink = sink + erased.erase (probe, std::nothrow);
+  }
+  report ("Dictionary::erase (nothrow)", items, seconds_since (start));
+}
+
+/**
+ * Builds a map of long URL-like keys (64 to 256 bytes) from empty, so it
+ * rehashes while growing, then looks up every key and as many misses.
+ */
+template<class KeyT>
+void bench_long_keys_with (const std::string &name)
+{
+  size_t items = MAP_ITEMS * scale;
+  std::vector<KeyT> keys, misses;
+  for (size_t i = 0; i < items; i++)
+  {
+    std::string url = "https://example.com/" + std::string (44 + i % 193, 'p')
+                      + "/" + std::to_string (i);
+    keys.push_back ({url});
+    url.back () = 'x';
+    misses.push_back ({url});
+  }
+  auto start = bench_clock::now ();
+  HashMap<KeyT, int> map;
+  for (size_t i = 0; i < items; i++)
+  {
+    map.insert (keys[i], (int) i);
+  }
+  report (name + " insert", items, seconds_since (start));
+  start = bench_clock::now ();
+  for (size_t i = 0; i < items; i++)
+  {
+    sink = sink + *map.find (keys[i]);
+  }
+  report (name + " hit", items, seconds_since (start));
+  start = bench_clock::now ();
+  for (size_t i = 0; i < items; i++)
+  {
+    sink = sink + (map.find (misses[i]) == nullptr);
+  }
+  report (name + " miss", items, seconds_since (start));
+}
+
+void bench_long_keys ()
+{
+  bench_long_keys_with<uncached_key> ("uncached");
+  bench_long_keys_with<std::string> ("cached hash");
+}
+
+/**
+ * Dictionary::update with a large vector of pairs against assigning the
+ * pairs one by one.
+ */
+void bench_bulk_update ()
+{
+  size_t items = 10 * MAP_ITEMS * scale;
+  std::vector<std::pair<std::string, std::string>> pairs;
+  for (size_t i = 0; i < items; i++)
+  {
+    pairs.emplace_back ("key:" + std::to_string (i), "value");
+  }
+  auto start = bench_clock::now ();
+  Dictionary one_by_one;
+  for (const auto &pair: pairs)
+  {
+    one_by_one[pair.first] = pair.second;
+  }
+  report ("operator[] loop", items, seconds_since (start));
+  start = bench_clock::now ();
+  Dictionary bulk;
+  bulk.update (pairs.begin (), pairs.end ());
+  report ("update", items, seconds_since (start));
+  sink = sink + (bulk == one_by_one);
+}
+
+/**
+ * Merges two Dictionaries of 1M entries each (10M at scale 10) that share
+ * half of their keys, by merge and by assigning every item of the
+ * overrides through operator[].
+ */
+void bench_merge ()
+{
+  size_t items = 10 * MAP_ITEMS * scale;
+  Dictionary base, overrides;
+  for (size_t i = 0; i < items; i++)
+  {
+    base["key:" + std::to_string (i)] = std::string (48, 'b');
+    overrides["key:" + std::to_string (i + items / 2)]
+        = std::string (48, 'o');
+  }
+  Dictionary assigned (base);
+  auto start = bench_clock::now ();
+  for (const auto &item: overrides)
+  {
+    assigned[item.first] = item.second;
+  }
+  report ("operator[] over items", items, seconds_since (start));
+  start = bench_clock::now ();
+  base.merge (std::move (overrides));
+  report ("merge", items, seconds_since (start));
+  sink = sink + (base == assigned);
+}
+
+/**
+ * One thread per NUMA node, bound to that node, looks up the keys of its
+ * own node's shard, and then the keys of the next node's shard. On a
+ * single-node machine both runs are local.
+ */
+void bench_numa ()
+{
+  typedef NumaHashMap<uint64_t, uint64_t> numa_map;
+  size_t items = 10 * MAP_ITEMS * scale;
+  numa_map map;
+  int nodes = map.node_count ();
+  vector<vector<uint64_t>> keys (nodes);
+  for (uint64_t i = 0; i < items; i++)
+  {
+    keys[map.node_of (i)].push_back (i);
+  }
+  map.run_on_nodes ([&keys] (int node, numa_map::shard_type &shard)
+                    {
+                      shard.reserve (keys[node].size ());
+                      for (uint64_t key: keys[node])
+                      {
+                        shard.insert (key, key);
+                      }
+                    });
+  cout << "  nodes: " << nodes << endl;
+  for (int offset : {0, 1})
+  {
+    auto start = bench_clock::now ();
+    map.run_on_nodes ([&map, &keys, nodes, offset] (int node,
+                                                    numa_map::shard_type &)
+                      {
+                        int target = (node + offset) % nodes;
+                        const numa_map::shard_type &shard = map.shard (target);
+                        size_t total = 0;
+                        for (uint64_t key: keys[target])
+                        {
+                          total += *shard.find (key);
+                        }
+                        sink = sink + total;
+                      });
+    report (offset == 0 ? "node-local lookups" : "next-node lookups",
+            items, seconds_since (start));
+  }
+}
+
+/**
+ * Random lookups in a map whose buckets array (about 100 MiB at scale 1)
+ * is far larger than the last level cache, with a heap-allocated array and
+ * with a huge-page-backed one.
+ */
+template<class TableAllocator>
+void bench_large_table_with (const std::string &name)
+{
+  size_t items = 20 * MAP_ITEMS * scale;
+  HashMap<uint64_t, uint64_t, TableAllocator> map;
+  map.reserve (items);
+  for (uint64_t i = 0; i < items; i++)
+  {
+    map.insert (i * NODE_HASH_MULTIPLIER, i);
+  }
+  size_t lookups = 10 * items;
+  uint64_t state = 1;
+  auto start = bench_clock::now ();
+  for (size_t i = 0; i < lookups; i++)
+  {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    sink = sink + *map.find ((state >> 33) % items * NODE_HASH_MULTIPLIER);
+  }
+  report (name + " random lookups", lookups, seconds_since (start));
+}
+
+void bench_large_table ()
+{
+  bench_large_table_with<heap_table_allocator> ("heap table");
+  bench_large_table_with<hugepage_table_allocator> ("huge page table");
+}
+
+/**
+ * Sequential find against find_many on maps of uint64_t keys sized from 1x
+ * to 100x the last level cache, as far as MEMORY_BUDGET (times the scale)
+ * allows. Half of the lookups miss.
+ */
+void bench_batched_lookup ()
+{
+  long llc = sysconf (_SC_LEVEL3_CACHE_SIZE);
+  if (llc <= 0)
+  {
+    llc = 32L << 20;
+  }
+  cout << "  LLC: " << (llc >> 20) << " MiB" << endl;
+  for (int multiple : {1, 4, 10, 25, 100})
+  {
+    size_t items = (size_t) multiple * llc / BYTES_PER_SMALL_ITEM;
+    if (items * BYTES_PER_SMALL_ITEM > MEMORY_BUDGET * scale)
+    {
+      cout << "  " << multiple << "x LLC skipped, over the memory budget"
+           << endl;
+      continue;
+    }
+    HashMap<uint64_t, uint64_t> map;
+    map.reserve (items);
+    for (uint64_t i = 0; i < items; i++)
+    {
+      map.insert (i * NODE_HASH_MULTIPLIER, i);
+    }
+    vector<uint64_t> keys (std::min<size_t> (items, 4 * MAP_ITEMS * scale));
+    uint64_t state = 7;
+    for (auto &key: keys)
+    {
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+      key = (state >> 33) % (2 * items) * NODE_HASH_MULTIPLIER;
+    }
+    std::string name = std::to_string (multiple) + "x LLC ";
+    auto start = bench_clock::now ();
+    for (auto key: keys)
+    {
+      const uint64_t *value = map.find (key);
+      sink = sink + (value == nullptr ? 0 : *value);
+    }
+    report (name + "find", keys.size (), seconds_since (start));
+    vector<const uint64_t *> results (keys.size ());
+    start = bench_clock::now ();
+    map.find_many (keys.data (), keys.size (), results.data ());
+    for (auto value: results)
+    {
+      sink = sink + (value == nullptr ? 0 : *value);
+    }
+    report (name + "find_many", keys.size (), seconds_since (start));
+  }
+}
+
+/**
+ * contains_key on a Dictionary, a FilteredDictionary with its Bloom filter
+ * and a frozen one with its xor filter, as the share of missing keys grows.
+ */
+void bench_filtered_lookup ()
+{
+  size_t items = 10 * MAP_ITEMS * scale;
+  Dictionary plain;
+  FilteredDictionary filtered;
+  for (size_t i = 0; i < items; i++)
+  {
+    plain.insert ("key:" + std::to_string (i), "value");
+    filtered.insert ("key:" + std::to_string (i), "value");
+  }
+  FilteredDictionary frozen (filtered);
+  frozen.freeze ();
+  report_memory ("bloom filter", filtered.stats ().filter_bytes);
+  report_memory ("xor filter", frozen.stats ().filter_bytes);
+  for (int miss_percent : {0, 50, 80, 95, 100})
+  {
+    std::vector<std::string> probes;
+    for (size_t i = 0; i < items; i++)
+    {
+      bool miss = (int) (i * 7919 % 100) < miss_percent;
+      probes.push_back ((miss ? "miss:" : "key:") + std::to_string (i));
+    }
+    std::string name = std::to_string (miss_percent) + "% misses ";
+    auto start = bench_clock::now ();
+    for (const auto &probe: probes)
+    {
+      sink = sink + plain.contains_key (probe);
+    }
+    report (name + "unfiltered", items, seconds_since (start));
+    start = bench_clock::now ();
+    for (const auto &probe: probes)
+    {
+      sink = sink + filtered.contains_key (probe);
+    }
+    report (name + "bloom", items, seconds_since (start));
+    start = bench_clock::now ();
+    for (const auto &probe: probes)
+    {
+      sink = sink + frozen.contains_key (probe);
+    }
+    report (name + "xor", items, seconds_since (start));
+  }
+}
+
+/**
+ * @return count keys drawn from a Zipf distribution over key_space keys,
+ * where key i is drawn in proportion to 1 / (i + 1)^ZIPF_EXPONENT.
+ */
+std::vector<int> zipf_trace (int key_space, size_t count)
+{
+  std::vector<double> cdf (key_space);
+  double total = 0;
+  for (int i = 0; i < key_space; i++)
+  {
+    total += 1 / std::pow (i + 1, ZIPF_EXPONENT);
+    cdf[i] = total;
+  }
+  std::vector<int> trace (count);
+  uint64_t state = 11;
+  for (auto &key: trace)
+  {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    double point = (double) (state >> 11) / (1ULL << 53) * total;
+    key = (int) (std::lower_bound (cdf.begin (), cdf.end (), point)
+                 - cdf.begin ());
+  }
+  return trace;
+}
+
+/**
+ * Read-through caching of a Zipfian trace: a miss puts the key. Reports
+ * throughput and hit rate for caches of 1% and 10% of the keys, for a
+ * BoundedCache and for a ConcurrentBoundedCache shared by CACHE_THREADS
+ * threads.
+ */
+void bench_cache ()
+{
+  int key_space = (int) (10 * MAP_ITEMS * scale);
+  std::vector<int> trace = zipf_trace (key_space, 2 * WRITES * scale);
+  for (int percent : {1, 10})
+  {
+    size_t entries = (size_t) key_space * percent / 100;
+    std::string name = std::to_string (percent) + "% cache ";
+    BoundedCache<int, std::string> cache (entries);
+    auto start = bench_clock::now ();
+    for (int key: trace)
+    {
+      const std::string *value = cache.get (key);
+      if (value == nullptr)
+      {
+        cache.put (key, "value");
+      }
+      sink = sink + (value != nullptr);
+    }
+    report (name + "CLOCK", trace.size (), seconds_since (start));
+    cout << "  " << name << "hit rate: " << cache.stats ().hit_rate () << endl;
+    ConcurrentBoundedCache<int, std::string> shared (entries);
+    start = bench_clock::now ();
+    run_on_threads (CACHE_THREADS, [&shared, &trace] (unsigned thread)
+    {
+      std::string value;
+      for (size_t i = thread; i < trace.size (); i += CACHE_THREADS)
+      {
+        if (!shared.get (trace[i], value))
+        {
+          shared.put (trace[i], "value");
+        }
+      }
+    });
+    report (name + "sharded", trace.size (), seconds_since (start));
+    cout << "  " << name << "sharded hit rate: "
+         << shared.stats ().hit_rate () << endl;
+  }
+}
+
+/**
+ * Expiring 90% of a map of session tokens: iterating a HashMap of
+ * expiry times and erasing the expired keys, against ExpiringHashMap::sweep
+ * over SWEEP_BUCKETS buckets per call. Also reports the longest sweep step,
+ * and the last one, which shrinks the map.
+ */
+void bench_expiry ()
+{
+  size_t items = 10 * MAP_ITEMS * scale;
+  auto now = std::chrono::steady_clock::now ();
+  HashMap<std::string, std::chrono::steady_clock::time_point> expiries;
+  ExpiringHashMap<std::string, std::string> sessions;
+  for (size_t i = 0; i < items; i++)
+  {
+    std::string key = "session:" + std::to_string (i);
+    auto ttl = std::chrono::hours (i % 10 == 0 ? 1 : 0);
+    expiries.insert (key, now + ttl);
+    sessions.insert (key, "token", ttl);
+  }
+  auto start = bench_clock::now ();
+  std::vector<std::string> expired;
+  for (const auto &element: expiries)
+  {
+    if (element.second <= bench_clock::now ())
+    {
+      expired.push_back (element.first);
+    }
+  }
+  for (const auto &key: expired)
+  {
+    expiries.erase (key);
+  }
+  report ("iterate + erase", items, seconds_since (start));
+  double longest = 0;
+  double last = 0;
+  start = bench_clock::now ();
+  do
+  {
+    auto call = bench_clock::now ();
+    sink = sink + sessions.sweep (SWEEP_BUCKETS);
+    last = seconds_since (call);
+    if (sessions.sweep_in_progress ())
+    {
+      longest = std::max (longest, last);
+    }
+  }
+  while (sessions.sweep_in_progress ());
+  report ("sweep", items, seconds_since (start));
+  report ("longest sweep step", 1, longest);
+  report ("last sweep step and shrink", 1, last);
+  sink = sink + expiries.size () + sessions.size ();
+}
+
+/**
+ * A tag -> ids mapping with TAGS tags: building and scanning a
+ * MultiDictionary against a HashMap of vectors, and their heap use.
+ */
+void bench_multi_dictionary ()
+{
+  size_t items = 10 * MAP_ITEMS * scale;
+  std::vector<std::string> tags, ids;
+  uint64_t state = 5;
+  for (size_t i = 0; i < items; i++)
+  {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    tags.push_back ("tag:" + std::to_string ((state >> 33) % TAGS));
+    ids.push_back (std::to_string (i));
+  }
+  size_t heap_before = heap_in_use ();
+  auto start = bench_clock::now ();
+  HashMap<std::string, std::vector<std::string>> vectors;
+  for (size_t i = 0; i < items; i++)
+  {
+    vectors[tags[i]].push_back (ids[i]);
+  }
+  report ("vectors insert", items, seconds_since (start));
+  report_memory ("vectors heap", heap_in_use () - heap_before);
+  heap_before = heap_in_use ();
+  start = bench_clock::now ();
+  MultiDictionary multi;
+  for (size_t i = 0; i < items; i++)
+  {
+    multi.insert (tags[i], ids[i]);
+  }
+  report ("multi insert", items, seconds_since (start));
+  report_memory ("multi heap", heap_in_use () - heap_before);
+  multi.compact ();
+  report_memory ("multi heap compacted", heap_in_use () - heap_before);
+  start = bench_clock::now ();
+  for (int tag = 0; tag < TAGS; tag++)
+  {
+    for (const auto &id: vectors["tag:" + std::to_string (tag)])
+    {
+      sink = sink + id.size ();
+    }
+  }
+  report ("vectors scan", items, seconds_since (start));
+  start = bench_clock::now ();
+  for (int tag = 0; tag < TAGS; tag++)
+  {
+    auto range = multi.equal_range ("tag:" + std::to_string (tag));
+    for (const std::string *id = range.first; id != range.second; id++)
+    {
+      sink = sink + id->size ();
+    }
+  }
+  report ("multi scan", items, seconds_since (start));
+}
+
+/**
+ * Inserts up to SCALE_TARGET_ITEMS small entries into one HashMap, within
+ * MEMORY_BUDGET times the scale (e.g. Bench billion_entries 256 for a
+ * 256 GiB budget). Stops before the budget would be exceeded, including by
+ * the next doubling of the buckets array, and reports how far it got and
+ * the memory a full run needs at the measured bytes per entry.
+ */
+void bench_billion_entries ()
+{
+  size_t budget = MEMORY_BUDGET * scale;
+  size_t heap_before = heap_in_use ();
+  HashMap<uint32_t, uint32_t> map;
+  size_t items = 0;
+  size_t used = 0;
+  auto start = bench_clock::now ();
+  while (items < SCALE_TARGET_ITEMS)
+  {
+    if (items % HEAP_CHECK_INTERVAL == 0)
+    {
+      used = heap_in_use () - heap_before;
+    }
+    bool grows = (double) (items + 1) / map.capacity ()
+                 > (double) UPPER_LOAD_FACTOR;
+    size_t next_table = grows ? 2 * map.capacity () * sizeof (vector<int>) : 0;
+    if (used + next_table > budget)
+    {
+      break;
+    }
+    map.insert ((uint32_t) items, (uint32_t) items);
+    items++;
+  }
+  double seconds = seconds_since (start);
+  used = heap_in_use () - heap_before;
+  report ("insert", items, seconds);
+  cout << "  entries: " << map.size () << " of " << SCALE_TARGET_ITEMS
+       << ", capacity: " << map.capacity () << endl;
+  report_memory ("heap", used);
+  double per_entry = (double) used / std::max<size_t> (items, 1);
+  cout << "  bytes per entry: " << per_entry << endl;
+  report_memory ("projected heap for the target",
+                 (size_t) (per_entry * SCALE_TARGET_ITEMS));
+}
+
+/**
+ * A dictionary of user ids to values drawn from a low-cardinality mix of
+ * country codes and account statuses, most of them frequent: Dictionary
+ * against InterningDictionary, for heap use, inserts and lookups.
+ */
+void bench_interning ()
+{
+  size_t items = 10 * MAP_ITEMS * scale;
+  const char *statuses[] = {"ACTIVE_SUBSCRIPTION", "PENDING_EMAIL_VERIFICATION",
+                            "SUSPENDED_PAYMENT_FAILURE", "CLOSED_BY_USER"};
+  std::vector<int> picks = zipf_trace (200, items);
+  std::vector<std::string> keys, values;
+  for (size_t i = 0; i < items; i++)
+  {
+    keys.push_back ("user:" + std::to_string (i));
+    int pick = picks[i];
+    values.push_back (pick < 4 ? statuses[pick]
+                               : "C" + std::to_string (pick));
+  }
+  size_t heap_before = heap_in_use ();
+  auto start = bench_clock::now ();
+  Dictionary plain;
+  for (size_t i = 0; i < items; i++)
+  {
+    plain.insert (keys[i], values[i]);
+  }
+  report ("dictionary insert", items, seconds_since (start));
+  report_memory ("dictionary heap", heap_in_use () - heap_before);
+  heap_before = heap_in_use ();
+  start = bench_clock::now ();
+  InterningDictionary<> interned;
+  for (size_t i = 0; i < items; i++)
+  {
+    interned.insert (keys[i], values[i]);
+  }
+  report ("interning insert", items, seconds_since (start));
+  report_memory ("interning heap", heap_in_use () - heap_before);
+  InterningStats stats = interned.stats ();
+  cout << "  distinct values: " << stats.distinct_strings
+       << ", dedup ratio: " << stats.dedup_ratio () << endl;
+  report_memory ("values unpooled", stats.unpooled_bytes);
+  report_memory ("values pooled", stats.handle_bytes + stats.pool_bytes);
+  start = bench_clock::now ();
+  for (const auto &key: keys)
+  {
+    sink = sink + plain.at (key).size ();
+  }
+  report ("dictionary at", items, seconds_since (start));
+  start = bench_clock::now ();
+  for (const auto &key: keys)
+  {
+    sink = sink + interned.at (key).size ();
+  }
+  report ("interning at", items, seconds_since (start));
+}
+
+/**
+ * Sorted export and a prefix query: copying a Dictionary out and sorting
+ * or filtering it, against the index of an OrderedDictionary. Also reports
+ * what keeping the index costs inserts.
+ */
+void bench_ordered ()
+{
+  size_t items = 10 * MAP_ITEMS * scale;
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < items; i++)
+  {
+    keys.push_back ((i % 10 ? "user:" : "admin:")
+                    + std::to_string (i * 2654435761ULL % items));
+  }
+  Dictionary plain;
+  auto start = bench_clock::now ();
+  for (const auto &key: keys)
+  {
+    plain.insert (key, "value");
+  }
+  report ("dictionary insert", items, seconds_since (start));
+  OrderedDictionary ordered;
+  start = bench_clock::now ();
+  for (const auto &key: keys)
+  {
+    ordered.insert (key, "value");
+  }
+  report ("ordered insert", items, seconds_since (start));
+  start = bench_clock::now ();
+  std::vector<std::string> sorted;
+  for (const auto &element: plain)
+  {
+    sorted.push_back (element.first);
+  }
+  std::sort (sorted.begin (), sorted.end ());
+  for (const auto &key: sorted)
+  {
+    sink = sink + key.size ();
+  }
+  report ("copy + sort export", items, seconds_since (start));
+  start = bench_clock::now ();
+  for (auto it = ordered.ordered_begin (); it != ordered.ordered_end (); ++it)
+  {
+    sink = sink + it->size ();
+  }
+  report ("ordered export", items, seconds_since (start));
+  start = bench_clock::now ();
+  for (const auto &element: plain)
+  {
+    if (element.first.compare (0, 6, "admin:") == 0)
+    {
+      sink = sink + element.first.size ();
+    }
+  }
+  report ("scan prefix query", items / 10, seconds_since (start));
+  start = bench_clock::now ();
+  auto admins = ordered.prefix_range ("admin:");
+  for (auto it = admins.first; it != admins.second; ++it)
+  {
+    sink = sink + it->size ();
+  }
+  report ("prefix_range query", items / 10, seconds_since (start));
+}
+
+void bench_durability ()
+{
+  struct policy_case
+  {
+    const char *name;
+    FsyncPolicy policy;
+    size_t group_records;
+    size_t writes;
+  };
+  const policy_case cases[] = {
+      {"fsync per mutation", FSYNC_ALWAYS, 1, SYNCED_WRITES * scale},
+      {"fsync per group of 64", FSYNC_ALWAYS, GROUP_COMMIT_RECORDS,
+       SYNCED_WRITES * GROUP_COMMIT_RECORDS * scale},
+      {"periodic fsync, group of 64", FSYNC_PERIODIC, GROUP_COMMIT_RECORDS,
+       WRITES * scale},
+      {"no fsync, group of 64", FSYNC_NEVER, GROUP_COMMIT_RECORDS,
+       WRITES * scale},
+      {"no fsync, write per mutation", FSYNC_NEVER, 1, WRITES * scale},
+  };
+  Dictionary plain;
+  auto start = bench_clock::now ();
+  for (size_t i = 0; i < WRITES * scale; i++)
+  {
+    plain[std::to_string (i % MAP_ITEMS)] = "value";
+  }
+  report ("in-memory dictionary", WRITES * scale, seconds_since (start));
+  for (const auto &curr: cases)
+  {
+    char path[] = "/tmp/durable_benchXXXXXX";
+    if (mkdtemp (path) == nullptr)
+    {
+      cout << "  can't create a directory under /tmp" << endl;
+      return;
+    }
+    std::string dir = path;
+    {
+      WalOptions options;
+      options.fsync_policy = curr.policy;
+      options.group_records = curr.group_records;
+      DurableDictionary durable (dir, options);
+      start = bench_clock::now ();
+      for (size_t i = 0; i < curr.writes; i++)
+      {
+        durable[std::to_string (i % MAP_ITEMS)] = "value";
+      }
+      durable.commit ();
+      report (curr.name, curr.writes, seconds_since (start));
+      start = bench_clock::now ();
+      durable.checkpoint ();
+      report ("  then checkpoint, per entry", durable.size (),
+              seconds_since (start));
+    }
+    start = bench_clock::now ();
+    {
+      DurableDictionary recovered (dir);
+      sink = sink + recovered.size ();
+    }
+    report ("  then recover, per entry", std::min (curr.writes,
+                                                 (size_t) MAP_ITEMS),
+            seconds_since (start));
+    for (const char *file : {WAL_FILE, SNAPSHOT_FILE})
+    {
+      ::unlink ((dir + file).c_str ());
+    }
+    ::rmdir (dir.c_str ());
+  }
+}
+
+void bench_serialization ()
+{
+  size_t items = 10 * MAP_ITEMS * scale;
+  HashMap<int, int> numbers;
+  Dictionary words;
+  for (size_t i = 0; i < items; i++)
+  {
+    numbers.insert ((int) (i * 2654435761ULL), (int) i);
+    words.insert ("key:" + std::to_string (i), "value:" + std::to_string (i));
+  }
+  auto start = bench_clock::now ();
+  std::stringstream text;
+  for (const auto &element: numbers)
+  {
+    text << element.first << ' ' << element.second << '\n';
+  }
+  report ("int map, operator<< loop save", items, seconds_since (start));
+  start = bench_clock::now ();
+  HashMap<int, int> loaded;
+  int key;
+  int value;
+  while (text >> key >> value)
+  {
+    loaded[key] = value;
+  }
+  report ("int map, operator[] loop load", items, seconds_since (start));
+  start = bench_clock::now ();
+  std::stringstream binary;
+  numbers.serialize (binary);
+  report ("int map, serialize", items, seconds_since (start));
+  start = bench_clock::now ();
+  HashMap<int, int> deserialized;
+  deserialized.deserialize (binary);
+  report ("int map, deserialize", items, seconds_since (start));
+  sink = sink + loaded.size () + deserialized.size ();
+
+  start = bench_clock::now ();
+  std::stringstream word_text;
+  for (const auto &element: words)
+  {
+    word_text << element.first << ' ' << element.second << '\n';
+  }
+  report ("dictionary, operator<< loop save", items, seconds_since (start));
+  start = bench_clock::now ();
+  Dictionary word_loaded;
+  std::string word;
+  std::string meaning;
+  while (word_text >> word >> meaning)
+  {
+    word_loaded[word] = meaning;
+  }
+  report ("dictionary, operator[] loop load", items, seconds_since (start));
+  start = bench_clock::now ();
+  std::stringstream word_binary;
+  words.serialize (word_binary);
+  report ("dictionary, serialize", items, seconds_since (start));
+  start = bench_clock::now ();
+  Dictionary word_deserialized;
+  word_deserialized.deserialize (word_binary);
+  report ("dictionary, deserialize", items, seconds_since (start));
+  sink = sink + word_loaded.size () + word_deserialized.size ();
+}
+
+/**
+ * HOT_KEY_THREADS threads incrementing counters picked from a Zipf trace,
+ * most of them on a few hot keys: a HashMap behind one mutex, against
+ * StripedHashMap::update_if_present. Then the same with one insertion per
+ * hundred updates, which the striped map mostly does within a stripe.
+ */
+void bench_striped ()
+{
+  int key_space = MAP_ITEMS;
+  std::vector<int> trace = zipf_trace (key_space, 4 * WRITES * scale);
+  for (int insert_every : {0, 100})
+  {
+    std::string suffix = insert_every == 0 ? "" : ", 1% inserts";
+    HashMap<int, long> locked;
+    StripedHashMap<int, long> striped;
+    for (int key = 0; key < key_space; key++)
+    {
+      locked.insert (key, 0);
+      striped.insert (key, 0);
+    }
+    std::mutex table_lock;
+    auto start = bench_clock::now ();
+    run_on_threads (HOT_KEY_THREADS, [&] (unsigned thread)
+    {
+      for (size_t i = thread; i < trace.size (); i += HOT_KEY_THREADS)
+      {
+        std::lock_guard<std::mutex> guard (table_lock);
+        if (insert_every != 0 && i % insert_every == 0)
+        {
+          locked.insert (key_space + (int) i, 1);
+        }
+        else
+        {
+          (*locked.find (trace[i]))++;
+        }
+      }
+    });
+    report ("mutex-wrapped HashMap" + suffix, trace.size (),
+            seconds_since (start));
+    start = bench_clock::now ();
+    run_on_threads (HOT_KEY_THREADS, [&] (unsigned thread)
+    {
+      for (size_t i = thread; i < trace.size (); i += HOT_KEY_THREADS)
+      {
+        if (insert_every != 0 && i % insert_every == 0)
+        {
+          striped.insert (key_space + (int) i, 1);
+        }
+        else
+        {
+          striped.update_if_present (trace[i], [] (long &value) { value++; });
+        }
+      }
+    });
+    report ("striped update_if_present" + suffix, trace.size (),
+            seconds_since (start));
+    sink = sink + locked.size () + striped.size ();
+  }
+  cout << "  " << std::thread::hardware_concurrency ()
+       << " hardware threads" << endl;
+}
+
+/**
+ * Counting the words of a Zipf-distributed text: HashMap<string, int>
+ * with map[word]++, against CounterMap::increment on one thread and on
+ * HOT_KEY_THREADS threads, and against per-thread local buffers.
+ */
+void bench_word_count ()
+{
+  std::vector<int> trace = zipf_trace (VOCABULARY, 2 * WRITES * scale);
+  std::vector<std::string> words;
+  words.reserve (trace.size ());
+  for (int word: trace)
+  {
+    words.push_back ("word" + std::to_string (word));
+  }
+  HashMap<std::string, int> plain;
+  auto start = bench_clock::now ();
+  for (const auto &word: words)
+  {
+    plain[word]++;
+  }
+  report ("HashMap map[word]++", words.size (), seconds_since (start));
+  CounterMap<std::string> single;
+  start = bench_clock::now ();
+  for (const auto &word: words)
+  {
+    single.increment (word);
+  }
+  report ("CounterMap increment, 1 thread", words.size (),
+          seconds_since (start));
+  CounterMap<std::string> shared;
+  start = bench_clock::now ();
+  run_on_threads (HOT_KEY_THREADS, [&shared, &words] (unsigned thread)
+  {
+    for (size_t i = thread; i < words.size (); i += HOT_KEY_THREADS)
+    {
+      shared.increment (words[i]);
+    }
+  });
+  report ("CounterMap increment, " + std::to_string (HOT_KEY_THREADS)
+          + " threads", words.size (), seconds_since (start));
+  CounterMap<std::string> buffered;
+  start = bench_clock::now ();
+  run_on_threads (HOT_KEY_THREADS, [&buffered, &words] (unsigned thread)
+  {
+    CounterMap<std::string>::local_buffer buffer (buffered);
+    for (size_t i = thread; i < words.size (); i += HOT_KEY_THREADS)
+    {
+      buffer.increment (words[i]);
+    }
+  });
+  report ("local buffers, " + std::to_string (HOT_KEY_THREADS) + " threads",
+          words.size (), seconds_since (start));
+  start = bench_clock::now ();
+  auto top = buffered.top_k (10);
+  report ("top_k (10), per word counted", buffered.size (),
+          seconds_since (start));
+  sink = sink + plain.size () + single.size () + shared.size ()
+         + (size_t) top[0].second;
+}
+
+/**
+ * HOT_KEY_THREADS threads writing into one dictionary: a Dictionary behind
+ * a mutex, against per-thread write buffers of a BufferedDictionary
+ * flushed every BUFFER_MAX_KEYS keys. Once with every write adding a key,
+ * once with the writes cycling over MAP_ITEMS keys.
+ */
+void bench_buffered_writes ()
+{
+  size_t writes = WRITES * scale;
+  for (size_t key_space : {writes, (size_t) MAP_ITEMS})
+  {
+    std::string suffix = key_space == writes ? ", new keys"
+                                             : ", rewriting keys";
+    std::vector<std::string> keys;
+    keys.reserve (writes);
+    for (size_t i = 0; i < writes; i++)
+    {
+      keys.push_back ("key:" + std::to_string (i * 2654435761ULL
+                                               % key_space));
+    }
+    Dictionary locked;
+    std::mutex dictionary_lock;
+    auto start = bench_clock::now ();
+    run_on_threads (HOT_KEY_THREADS, [&] (unsigned thread)
+    {
+      for (size_t i = thread; i < writes; i += HOT_KEY_THREADS)
+      {
+        std::lock_guard<std::mutex> guard (dictionary_lock);
+        locked[keys[i]] = "value";
+      }
+    });
+    report ("mutex-wrapped Dictionary" + suffix, writes,
+            seconds_since (start));
+    BufferedDictionary buffered;
+    start = bench_clock::now ();
+    run_on_threads (HOT_KEY_THREADS, [&] (unsigned thread)
+    {
+      BufferedDictionary::write_buffer buffer (buffered);
+      for (size_t i = thread; i < writes; i += HOT_KEY_THREADS)
+      {
+        buffer.set (keys[i], "value");
+      }
+    });
+    report ("per-thread write buffers" + suffix, writes,
+            seconds_since (start));
+    sink = sink + locked.size () + buffered.size ();
+  }
+}
+
+/**
+ * Builds a HashMap<uint32_t, uint32_t> from 1M, 10M and 100M random keys
+ * drawn from one and a half times as many, so about a third repeat, with
+ * the sequential constructor and with the parallel one on one thread, four
+ * threads and every hardware thread. A size whose estimated heap exceeds
+ * the budget is skipped.
+ */
+void bench_parallel_build ()
+{
+  size_t budget = PARALLEL_BUILD_BUDGET * scale;
+  for (size_t items : {1000000UL, 10000000UL, 100000000UL})
+  {
+    std::string suffix = " (" + std::to_string (items / 1000000) + "M)";
+    //The map, the input vectors and the hashes and order of the partitions.
+    size_t estimate = items * (BYTES_PER_SMALL_ITEM + 2 * sizeof (uint32_t)
+                               + 2 * sizeof (size_t));
+    if (estimate > budget)
+    {
+      cout << "  skipped" << suffix << ": needs about "
+           << estimate / (1 << 20) << " MiB, over the budget of "
+           << budget / (1 << 20) << " MiB" << endl;
+      continue;
+    }
+    vector<uint32_t> keys (items);
+    vector<uint32_t> values (items);
+    uint64_t state = 11;
+    for (size_t i = 0; i < items; i++)
+    {
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+      keys[i] = (uint32_t) ((state >> 32) % (items * 3 / 2));
+      values[i] = (uint32_t) i;
+    }
+    size_t built;
+    {
+      auto start = bench_clock::now ();
+      HashMap<uint32_t, uint32_t> map (keys, values);
+      report ("sequential constructor" + suffix, items, seconds_since (start));
+      built = map.size ();
+    }
+    unsigned hardware = std::max (1u, std::thread::hardware_concurrency ());
+    vector<unsigned> thread_counts = {1, 4};
+    if (hardware != 1 && hardware != 4)
+    {
+      thread_counts.push_back (hardware);
+    }
+    for (unsigned threads : thread_counts)
+    {
+      auto start = bench_clock::now ();
+      HashMap<uint32_t, uint32_t> map (parallel_execution, keys, values,
+                                       threads);
+      report ("parallel, threads: " + std::to_string (threads) + suffix,
+              items, seconds_since (start));
+      sink = sink + (map.size () == built);
+    }
+  }
+}
+
+/**
+ * Hashes batches of 32-bit keys with each hash_batch kernel the CPU has,
+ * for a batch that stays in L1 and for one far larger than the LLC, then
+ * looks up 32-bit keys one by one and with find_many, which hashes them in
+ * batches.
+ */
+void bench_hash_batch ()
+{
+#if defined (__GLIBCXX__) && defined (__x86_64__)
+  for (size_t keys_count : {(size_t) HASH_BATCH_SMALL,
+                            (size_t) (HASH_BATCH_LARGE * scale)})
+  {
+    vector<uint32_t> keys (keys_count);
+    vector<size_t> hashes (keys_count);
+    uint32_t state = 7;
+    for (auto &key: keys)
+    {
+      state = state * 1664525 + 1013904223;
+      key = state;
+    }
+    size_t rounds = std::max<size_t> (1, CYCLES * 10 * scale / keys_count);
+    std::string suffix = " (" + std::to_string (keys_count) + " keys)";
+    typedef hash_batch<uint32_t> kernels;
+    vector<pair<std::string, kernels::kernel>> runs = {
+        {"scalar", kernels::scalar}};
+    if (__builtin_cpu_supports ("avx2"))
+    {
+      runs.emplace_back ("avx2", kernels::avx2);
+    }
+    if (__builtin_cpu_supports ("avx512f"))
+    {
+      runs.emplace_back ("avx512", kernels::avx512);
+    }
+    runs.emplace_back ("dispatched", kernels::apply);
+    for (const auto &run: runs)
+    {
+      auto start = bench_clock::now ();
+      for (size_t round = 0; round < rounds; round++)
+      {
+        run.second (keys.data (), keys.size (), hashes.data ());
+        sink = sink + hashes[round % keys_count];
+      }
+      report (run.first + suffix, rounds * keys_count, seconds_since (start));
+    }
+  }
+#endif
+
+  HashMap<uint32_t, uint32_t> map;
+  map.reserve (MAP_ITEMS * scale);
+  for (uint32_t i = 0; i < MAP_ITEMS * scale; i++)
+  {
+    map.insert (i * 2654435761u, i);
+  }
+  vector<uint32_t> lookups (4 * MAP_ITEMS * scale);
+  for (size_t i = 0; i < lookups.size (); i++)
+  {
+    lookups[i] = (uint32_t) (i * 7 % (2 * MAP_ITEMS * scale)) * 2654435761u;
+  }
+  auto start = bench_clock::now ();
+  for (auto key: lookups)
+  {
+    const uint32_t *value = map.find (key);
+    sink = sink + (value == nullptr ? 0 : *value);
+  }
+  report ("find", lookups.size (), seconds_since (start));
+  vector<const uint32_t *> results (lookups.size ());
+  start = bench_clock::now ();
+  map.find_many (lookups.data (), lookups.size (), results.data ());
+  for (auto value: results)
+  {
+    sink = sink + (value == nullptr ? 0 : *value);
+  }
+  report ("find_many", lookups.size (), seconds_since (start));
+}
+
+int main (int argc, char *argv[])
+{
+  typedef void (*bench_func) ();
+  struct bench_entry
+  {
+    const char *name;
+    bench_func func;
+  };
+
+  bench_entry benches[] = {
+      {"construct_cycles", bench_construct_cycles},
+      {"snapshots", bench_snapshots},
+      {"versions", bench_versions},
+      {"equality", bench_equality},
+      {"miss_lookup", bench_miss_lookup},
+      {"long_keys", bench_long_keys},
+      {"bulk_update", bench_bulk_update},
+      {"merge", bench_merge},
+      {"numa", bench_numa},
+      {"large_table", bench_large_table},
+      {"batched_lookup", bench_batched_lookup},
+      {"filtered_lookup", bench_filtered_lookup},
+      {"cache", bench_cache},
+      {"expiry", bench_expiry},
+      {"multi_dictionary", bench_multi_dictionary},
+      {"billion_entries", bench_billion_entries},
+      {"interning", bench_interning},
+      {"ordered", bench_ordered},
+      {"durability", bench_durability},
+      {"serialization", bench_serialization},
+      {"striped", bench_striped},
+      {"word_count", bench_word_count},
+      {"buffered_writes", bench_buffered_writes},
+      {"parallel_build", bench_parallel_build},
+      {"hash_batch", bench_hash_batch},
+  };
+
+  if (argc > 2)
+  {
+    scale = std::strtoul (argv[2], nullptr, 10);
+  }
+  for (auto &bench: benches)
+  {
+    if (argc > 1 && std::string (argv[1]) != bench.name
+        && std::string (argv[1]) != "all")
+    {
+      continue;
+    }
+    cout << bench.name << ":" << endl;
+    bench.func ();
+  }
+  return EXIT_SUCCESS;
+}
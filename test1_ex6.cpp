@@ -16,9 +16,24 @@
 // includes
 #include "HashMap.hpp"
 #include "Dictionary.hpp"
+#include "CowHashMap.hpp"
+#include "PersistentHashMap.hpp"
+#include "NumaHashMap.hpp"
+#include "FilteredDictionary.hpp"
+#include "BoundedCache.hpp"
+#include "ExpiringHashMap.hpp"
+#include "MultiDictionary.hpp"
+#include "StringPool.hpp"
+#include "OrderedDictionary.hpp"
+#include "DurableDictionary.hpp"
+#include "StripedHashMap.hpp"
+#include "CounterMap.hpp"
+#include "BufferedDictionary.hpp"
 #include <iostream>
 #include <utility>
 #include "sstream"
+#include <fstream>
+#include <limits>
 
 using namespace std;
 
@@ -53,6 +68,24 @@ struct std::hash<key_struct> {
     }
 };
 
+// Counts how many times keys of this type were hashed.
+static int counted_key_hashes = 0;
+
+struct counted_key {
+    string value;
+    bool operator==(const counted_key& other) const {
+      return value == other.value;
+    }
+};
+
+template <>
+struct std::hash<counted_key> {
+    size_t operator ()(const counted_key& key) const {
+      counted_key_hashes++;
+      return std::hash<string> {} (key.value);
+    }
+};
+
 // tests
 /**
  * @Tests:
@@ -221,7 +254,7 @@ void test_bucket_size ()
   }
 
   HashMap<int, int> h2 ({1, 2, 3, 4, 5}, {10, 20, 30, 40, 50});
-  int prev_bucket_size = h2.bucket_size (2);
+  size_t prev_bucket_size = h2.bucket_size (2);
   h2.erase (2);
   h2.insert (2, 2);
   assert(h2.bucket_size (2) == prev_bucket_size);
@@ -240,7 +273,7 @@ void test_bucket_index ()
   // std::hash() isn't consistent on different computers, so I can't
   // check for the exact bucket, only for the correct range (size of the map).
   for (int i = 1; i <= 5; i++)
-    assert(0 <= h1.bucket_index (i) && h1.bucket_index (i) <= 15);
+    assert(h1.bucket_index (i) <= 15);
   bool thrown = true;
   try
   {
@@ -252,7 +285,7 @@ void test_bucket_index ()
   }
 
   HashMap<int, int> h2 ({1, 2, 3, 4, 5}, {10, 20, 30, 40, 50});
-  int prev_bucket_index = h2.bucket_index (2);
+  size_t prev_bucket_index = h2.bucket_index (2);
   h2.erase (2);
   h2.insert (2, 2);
   assert(h2.bucket_index (2) == prev_bucket_index);
@@ -758,7 +791,7 @@ void test_dictionary_base_functionality ()
   assert(d1.insert ("a", "A") == true); // Insert works
   assert(d1.size () == 1); // Size works
   assert(d1.capacity () == 16);
-  assert(d1.bucket_index ("a") >= 0 && d1.bucket_index ("a") <= 15);
+  assert(d1.bucket_index ("a") <= 15);
   assert(d1.bucket_size ("a") > 0);
   assert(d1.erase ("a"));
   for (int i = 0; i < 13; i++) d1[to_string (i)] = to_string (i * 10);
@@ -980,7 +1013,7 @@ void test_const_correctness() {
   assert(h4.insert (a,"A"));
   assert(h4.at(a)=="A");
   assert(h4.contains_key (a));
-  assert(h4.bucket_index (a) != -1);
+  assert(h4.bucket_index (a) < h4.capacity ());
   assert(h4.bucket_size (a) == 1);
   assert(h4[a] == "A");
   assert(h4.erase (a));
@@ -1020,6 +1053,1548 @@ void test_const_correctness() {
   assert(h8.capacity()==32);
 }
 
+/**
+ * @tests:
+ * 0. Lookups on a map that never inserted don't crash
+ * 1. clear() keeps the capacity and the map is usable afterwards
+ * 2. Assignment between maps with different capacities after clear()
+ */
+void test_lazy_table ()
+{
+  START_TEST;
+  HashMap<int, int> h1;
+  assert(h1.capacity () == 16 && h1.empty ());
+  assert(h1.begin () == h1.end ());
+  assert(!h1.contains_key (1));
+  assert(h1.erase (1) == false);
+  bool thrown = true;
+  try
+  {
+    h1.at (1);
+    thrown = false;
+  }
+  catch (exception &e)
+  {
+    assert(thrown);
+  }
+  const HashMap<int, int> h2;
+  assert(h2[1] == 0);
+  HashMap<int, int> h3 (h2);
+  assert(h3.empty () && h3.capacity () == 16);
+  h3.clear ();
+  assert(h3.capacity () == 16);
+  h3[5] = 50;
+  assert(h3.at (5) == 50);
+
+  HashMap<int, int> h4;
+  for (int i = 0; i < 100; i++) h4[i] = i;
+  h4.clear ();
+  assert(h4.capacity () == 256 && h4.begin () == h4.end ());
+  h4 = h3;
+  assert(h4.capacity () == 16 && h4.size () == 1 && h4.at (5) == 50);
+  for (int i = 0; i < 100; i++) h4[i] = i;
+  assert(h4.size () == 100);
+}
+
+/**
+ * @tests:
+ * 0. A snapshot doesn't see writes made to the map after it was taken
+ * 1. Writes made after a snapshot don't change the snapshot, including
+ * rehashes, erases and clear()
+ * 2. Copies of a CowHashMap are independent
+ * 3. CowDictionary erase throws InvalidKey
+ */
+void test_cow_snapshot ()
+{
+  START_TEST;
+  CowHashMap<int, int> h1;
+  for (int i = 0; i < 10; i++) h1[i] = i * 10;
+  auto s1 = h1.snapshot ();
+  assert(s1.size () == 10 && s1.capacity () == 16);
+  h1[3] = 33;
+  h1.erase (4);
+  for (int i = 10; i < 100; i++) h1.insert (i, i * 10);
+  assert(h1.at (3) == 33 && !h1.contains_key (4) && h1.size () == 99);
+  assert(h1.capacity () == 256);
+  for (int i = 0; i < 10; i++) assert(s1.at (i) == i * 10);
+  assert(!s1.contains_key (10));
+  int counter = 0;
+  for (const auto &item: s1)
+  {
+    assert(item.second == item.first * 10);
+    counter++;
+  }
+  assert(counter == 10);
+  counter = 0;
+  for (const auto &item: h1) counter++;
+  assert(counter == 99);
+
+  auto s2 = h1.snapshot ();
+  h1.clear ();
+  assert(h1.empty () && h1.begin () == h1.end ());
+  assert(s2.size () == 99 && s2.at (3) == 33);
+  assert(s1.at (3) == 30);
+
+  CowHashMap<string, string> h2 ({"a", "b"}, {"A", "B"});
+  CowHashMap<string, string> h3 (h2);
+  h3["a"] = "C";
+  assert(h2.at ("a") == "A" && h3.at ("a") == "C");
+  assert(h2 != h3);
+  h3["a"] = "A";
+  assert(h2 == h3);
+
+  CowDictionary d1 ({"a"}, {"A"});
+  auto s3 = d1.snapshot ();
+  bool thrown = false;
+  try
+  {
+    d1.erase ("b");
+  }
+  catch (InvalidKey &e)
+  {
+    thrown = true;
+  }
+  assert(thrown);
+  assert(d1.erase ("a") && d1.empty () && s3.at ("a") == "A");
+}
+
+/**
+ * @tests:
+ * 0. insert, set and erase return new versions and leave the old ones intact
+ * 1. insert doesn't overwrite an existing key, set does
+ * 2. Keys with colliding hashes
+ * 3. Iteration visits every item exactly once
+ */
+void test_persistent_map ()
+{
+  START_TEST;
+  PersistentHashMap<int, int> v0;
+  assert(v0.empty () && v0.begin () == v0.end ());
+  PersistentHashMap<int, int> v1 = v0.insert (1, 10);
+  assert(v0.empty () && v1.size () == 1 && v1.at (1) == 10);
+  assert(v1.insert (1, 20).at (1) == 10);
+  PersistentHashMap<int, int> v2 = v1.set (1, 20);
+  assert(v1.at (1) == 10 && v2.at (1) == 20);
+
+  vector<PersistentHashMap<int, int>> versions = {v0};
+  for (int i = 0; i < 2000; i++)
+    versions.push_back (versions.back ().insert (i * 37, i));
+  for (int i = 0; i <= 2000; i += 250)
+  {
+    assert(versions[i].size () == (size_t) i);
+    if (i > 0) assert(versions[i].at ((i - 1) * 37) == i - 1);
+    assert(!versions[i].contains_key (i * 37));
+  }
+  PersistentHashMap<int, int> last = versions.back ();
+  long sum = 0;
+  int counter = 0;
+  for (const auto &item: last)
+  {
+    sum += item.second;
+    counter++;
+  }
+  assert(counter == 2000 && sum == 1999L * 2000 / 2);
+  PersistentHashMap<int, int> erased = last;
+  for (int i = 0; i < 2000; i += 2) erased = erased.erase (i * 37);
+  assert(erased.size () == 1000 && last.size () == 2000);
+  assert(!erased.contains_key (0) && erased.at (37) == 1);
+  assert(erased.erase (0) == erased);
+  for (int i = 1; i < 2000; i += 2) erased = erased.erase (i * 37);
+  assert(erased.empty () && erased == v0);
+  bool thrown = true;
+  try
+  {
+    erased.at (37);
+    thrown = false;
+  }
+  catch (exception &e)
+  {
+    assert(thrown);
+  }
+
+  // key_struct hashes only by y, so these keys collide completely.
+  PersistentHashMap<key_struct, int> c1;
+  for (int i = 0; i < 10; i++) c1 = c1.set (key_struct (to_string (i), 7), i);
+  c1 = c1.set (key_struct ("x", 39), 100);
+  assert(c1.size () == 11 && c1.at (key_struct ("3", 7)) == 3);
+  PersistentHashMap<key_struct, int> c2 = c1.erase (key_struct ("3", 7));
+  assert(c2.size () == 10 && !c2.contains_key (key_struct ("3", 7)));
+  assert(c1.contains_key (key_struct ("3", 7)));
+  assert(c1 != c2);
+
+  Dictionary d1 ({"a", "b"}, {"A", "B"});
+  PersistentHashMap<string, string> p1 (d1);
+  d1["a"] = "C";
+  assert(p1.at ("a") == "A" && p1.size () == 2);
+  PersistentHashMap<string, string> p2 ({"a", "a"}, {"A", "B"});
+  assert(p2.size () == 1 && p2.at ("a") == "B");
+}
+
+/**
+ * @tests:
+ * 0. diff reports added, removed and changed keys
+ * 1. diff works for maps with equal and with different capacities
+ * 2. Applying a diff turns one map into the other
+ * 3. Comparison of maps with equal capacities and different bucket contents
+ */
+void test_diff ()
+{
+  START_TEST;
+  HashMap<int, int> h1 ({1, 2, 3, 4}, {10, 20, 30, 40});
+  HashMap<int, int> h2 ({2, 3, 4, 5}, {20, 33, 40, 50});
+  assert(h1.capacity () == h2.capacity ());
+  auto changes = diff (h1, h2);
+  assert(changes.added.size () == 1 && changes.added[0].first == 5);
+  assert(changes.added[0].second == 50);
+  assert(changes.removed.size () == 1 && changes.removed[0] == 1);
+  assert(changes.changed.size () == 1 && changes.changed[0].first == 3);
+  assert(changes.changed[0].second == 33);
+  assert(diff (h1, h1).empty ());
+
+  HashMap<int, int> h3 (h1);
+  h3.apply (changes);
+  assert(h3 == h2);
+
+  HashMap<int, int> h4;
+  for (int i = 0; i < 100; i++) h4[i] = i;
+  HashMap<int, int> h5 (h1);
+  changes = diff (h4, h5);
+  assert(h4.capacity () != h5.capacity ());
+  assert(changes.removed.size () == 96 && changes.changed.size () == 4);
+  assert(changes.added.empty ());
+  h4.apply (changes);
+  assert(h4 == h5 && h5 == h4);
+
+  Dictionary d1 ({"a", "b"}, {"A", "B"});
+  Dictionary d2 ({"a", "c"}, {"A", "C"});
+  auto dict_changes = diff (d1, d2);
+  assert(dict_changes.removed.size () == 1 && dict_changes.removed[0] == "b");
+  d1.apply (dict_changes);
+  assert(d1 == d2);
+
+  // Same size and capacity, the keys differ.
+  HashMap<int, int> h6 ({1, 2}, {10, 20});
+  HashMap<int, int> h7 ({1, 18}, {10, 20});
+  assert(h6 != h7);
+}
+
+/**
+ * @tests:
+ * 0. find returns a pointer to the value or nullptr, and the value can be
+ * changed through it
+ * 1. get_or returns the default for missing keys
+ * 2. try_erase and Dictionary::erase(key, nothrow) don't throw
+ */
+void test_nothrow_lookup ()
+{
+  START_TEST;
+  HashMap<int, int> h1 ({1, 2}, {10, 20});
+  assert(h1.find (3) == nullptr);
+  assert(*h1.find (1) == 10);
+  *h1.find (1) = 11;
+  assert(h1.at (1) == 11);
+  const HashMap<int, int> h2 (h1);
+  assert(*h2.find (1) == 11 && h2.find (5) == nullptr);
+  assert(h2.get_or (2, -1) == 20 && h2.get_or (5, -1) == -1);
+  HashMap<int, int> h3;
+  assert(h3.find (1) == nullptr && h3.get_or (1, 7) == 7);
+  assert(h3.try_erase (1) == false);
+  assert(h1.try_erase (1) == true && h1.try_erase (1) == false);
+  assert(h1.size () == 1);
+
+  Dictionary d1 ({"a"}, {"A"});
+  assert(d1.erase ("b", std::nothrow) == false);
+  assert(d1.try_erase ("b") == false);
+  assert(d1.erase ("a", std::nothrow) == true && d1.empty ());
+  assert(d1.get_or ("a", "none") == "none");
+}
+
+/**
+ * @tests:
+ * 0. Keys with a cached hash are hashed once per operation, never by rehash
+ * 1. Arithmetic keys don't cache their hash by default
+ */
+void test_cached_hash ()
+{
+  START_TEST;
+  assert(cache_hash_code<string>::value);
+  assert(!cache_hash_code<int>::value && !cache_hash_code<int *>::value);
+  HashMap<counted_key, int> h1;
+  counted_key_hashes = 0;
+  for (int i = 0; i < 1000; i++) h1.insert ({to_string (i)}, i);
+  assert(h1.capacity () == 2048);
+  assert(counted_key_hashes == 1000); // Growing didn't hash keys again
+  counted_key_hashes = 0;
+  for (int i = 0; i < 900; i++) h1.erase ({to_string (i)});
+  assert(h1.capacity () == 256);
+  assert(counted_key_hashes == 900);
+  for (int i = 900; i < 1000; i++) assert(h1.at ({to_string (i)}) == i);
+  int counter = 0;
+  for (const auto &item: h1) counter += (item.second >= 900);
+  assert(counter == 100);
+  HashMap<counted_key, int> h2 (h1);
+  assert(h1 == h2);
+}
+
+/**
+ * @tests:
+ * 0. reserve grows the capacity once and never shrinks it
+ * 1. update on a large range matches one-by-one assignment, later pairs
+ * winning for repeated keys
+ * 2. update on a non random access range
+ * 3. update doesn't leave the map grown for keys it already had
+ */
+void test_bulk_update ()
+{
+  START_TEST;
+  HashMap<int, int> h1;
+  h1.reserve (100);
+  assert(h1.capacity () == 256 && h1.empty ());
+  for (int i = 0; i < 100; i++) h1[i] = i;
+  assert(h1.capacity () == 256);
+  h1.reserve (10);
+  assert(h1.capacity () == 256);
+
+  typedef pair<string, string> string_pair;
+  vector<string_pair> pairs;
+  for (int i = 0; i < 300000; i++)
+    pairs.emplace_back (to_string (i % 200000), to_string (i));
+  Dictionary d1, d2;
+  for (int i = 0; i < 1000; i++) d1[to_string (i)] = d2[to_string (i)] = "x";
+  d1["old"] = d2["old"] = "old";
+  d1.update (pairs.begin (), pairs.end ());
+  for (const auto &p: pairs) d2[p.first] = p.second;
+  assert(d1.size () == 200001 && d1 == d2);
+  assert(d1.at ("5") == "200005" && d1.at ("199999") == "199999");
+  assert(d1.at ("old") == "old" && d1.capacity () == d2.capacity ());
+
+  vector<string_pair> rewrites;
+  for (int i = 0; i < 1000; i++) rewrites.emplace_back (to_string (i), "y");
+  Dictionary d5;
+  for (const auto &p: rewrites) d5[p.first] = "x";
+  size_t capacity = d5.capacity ();
+  d5.update (rewrites.begin (), rewrites.end ());
+  assert(d5.capacity () == capacity && d5.at ("7") == "y");
+  assert(d5.get_load_factor () >= (double) LOWER_LOAD_FACTOR);
+
+  // Force the partitioned path, whatever the number of cores.
+  struct partitioned_dictionary : Dictionary
+  {
+    void update_on (vector<string_pair> &range, unsigned threads)
+    {
+      reserve (size () + (int) range.size ());
+      assign_partitioned (range.begin (), range.size (), threads);
+    }
+  };
+  partitioned_dictionary d4;
+  d4["old"] = "old";
+  d4.update_on (pairs, 4);
+  assert(d4.size () == 200001 && d4 == d1);
+
+  list<string_pair> linked ({string_pair ("a", "A"), string_pair ("a", "B")});
+  Dictionary d3;
+  d3.update (linked.begin (), linked.end ());
+  assert(d3.size () == 1 && d3.at ("a") == "B");
+}
+
+/**
+ * @tests:
+ * 0. merge with KEEP_EXISTING, OVERWRITE_EXISTING and a combine function
+ * 1. merge into an empty map and between maps of different capacities
+ * 2. other is left empty and usable
+ * 3. Values are moved, not copied
+ */
+void test_merge ()
+{
+  START_TEST;
+  HashMap<int, int> base ({1, 2, 3}, {10, 20, 30});
+  HashMap<int, int> keep (base), overwrite (base), sum (base);
+  HashMap<int, int> h1 ({3, 4}, {300, 400});
+  HashMap<int, int> h2 (h1), h3 (h1);
+  keep.merge (std::move (h1), KEEP_EXISTING);
+  assert(keep.size () == 4 && keep.at (3) == 30 && keep.at (4) == 400);
+  assert(h1.empty () && h1.begin () == h1.end ());
+  h1[7] = 70;
+  assert(h1.size () == 1 && h1.at (7) == 70);
+  overwrite.merge (std::move (h2));
+  assert(overwrite.size () == 4 && overwrite.at (3) == 300);
+  sum.merge (std::move (h3), [] (int &existing, int &&incoming)
+  { existing += incoming; });
+  assert(sum.at (3) == 330 && sum.at (1) == 10 && sum.at (4) == 400);
+
+  HashMap<int, int> empty, big;
+  for (int i = 0; i < 100; i++) big[i] = i;
+  empty.merge (std::move (big));
+  assert(empty.size () == 100 && empty.capacity () == 256 && big.empty ());
+
+  HashMap<int, int> small ({1000, 5}, {1, 2});
+  HashMap<int, int> large;
+  for (int i = 0; i < 100; i++) large[i] = -i;
+  small.merge (std::move (large));
+  assert(small.size () == 101 && small.at (5) == -5 && small.at (1000) == 1);
+  assert(small.capacity () == 256);
+  HashMap<int, int> tiny ({1, 2000}, {1, 2});
+  small.merge (std::move (tiny), KEEP_EXISTING);
+  assert(small.size () == 102 && small.at (1) == -1 && small.at (2000) == 2);
+
+  Dictionary d1 ({"a", "b"}, {"A", "B"});
+  Dictionary d2 ({"b", "c"}, {string (100, 'x'), "C"});
+  const char *buffer = d2.at ("b").data ();
+  d1.merge (std::move (d2));
+  assert(d1.size () == 3 && d1.at ("b").data () == buffer);
+  assert(d2.empty ());
+}
+
+/**
+ * @tests:
+ * 0. Kernel id lists are parsed
+ * 1. A HashMap with a NUMA table allocator works past the mmap threshold,
+ * also for nodes the machine doesn't have
+ * 2. NumaHashMap routes keys to shards and runs a task per node
+ * 3. merge between maps whose allocators differ
+ */
+void test_numa_map ()
+{
+  START_TEST;
+  assert(parse_id_list ("0-2,5,7-8") == vector<int> ({0, 1, 2, 5, 7, 8}));
+  assert(parse_id_list ("").empty () && numa_node_count () >= 1);
+
+  HashMap<int, int, numa_table_allocator> h1 (numa_table_allocator (3));
+  for (int i = 0; i < 10000; i++) h1[i] = i;
+  for (int i = 0; i < 10000; i += 3) h1.erase (i);
+  assert(h1.size () == 6666 && h1.at (10) == 10 && !h1.contains_key (9));
+  HashMap<int, int, numa_table_allocator> h2 (h1);
+  assert(h1 == h2);
+
+  NumaHashMap<string, int> n1 (3);
+  assert(n1.node_count () == 3 && n1.empty ());
+  for (int i = 0; i < 3000; i++) n1[to_string (i)] = i;
+  assert(n1.size () == 3000 && n1.at ("42") == 42);
+  int sizes[3] = {};
+  for (int node = 0; node < 3; node++)
+  {
+    sizes[node] = n1.shard (node).size ();
+    for (const auto &item: n1.shard (node))
+      assert(n1.node_of (item.first) == node);
+  }
+  assert(sizes[0] > 0 && sizes[1] > 0 && sizes[2] > 0);
+  typedef NumaHashMap<string, int>::shard_type numa_shard;
+  n1.run_on_nodes ([&n1] (int node, numa_shard &shard)
+                   {
+                     for (const auto &item: shard)
+                       assert(n1.node_of (item.first) == node);
+                     shard.clear ();
+                   });
+  assert(n1.empty () && n1.find ("42") == nullptr);
+  assert(n1.insert ("a", 1) && !n1.insert ("a", 2) && n1.erase ("a"));
+
+  HashMap<int, int, numa_table_allocator> h3 (numa_table_allocator (1));
+  h3.merge (std::move (h2));
+  assert(h3.size () == 6666 && h2.empty ());
+}
+
+/**
+ * @tests:
+ * 0. A HashMap with the huge page allocator grows past a huge page, shrinks
+ * back below it and is copied
+ */
+void test_hugepage_table ()
+{
+  START_TEST;
+  HashMap<int, int, hugepage_table_allocator> h1;
+  for (int i = 0; i < 100000; i++) h1.insert (i, i);
+  assert(h1.capacity () == 262144 && h1.at (99999) == 99999);
+  HashMap<int, int, hugepage_table_allocator> h2 (h1);
+  for (int i = 0; i < 99990; i++) h1.erase (i);
+  assert(h1.size () == 10 && h1.capacity () <= 64);
+  assert(h1.at (99995) == 99995 && h2.size () == 100000);
+  h2.clear ();
+  assert(h2.empty () && h2.capacity () == 262144);
+}
+
+/**
+ * @tests:
+ * 0. find_many agrees with find for hits and misses, for batches smaller
+ * and larger than the interleaving width
+ * 1. find_many on a map without a table
+ */
+void test_find_many ()
+{
+  START_TEST;
+  HashMap<string, int> h1;
+  for (int i = 0; i < 1000; i += 2) h1[to_string (i)] = i;
+  vector<string> keys;
+  for (int i = 0; i < 1000; i++) keys.push_back (to_string (i));
+  auto results = h1.find_many (keys);
+  assert(results.size () == 1000);
+  for (int i = 0; i < 1000; i++)
+    assert(results[i] == h1.find (keys[i]));
+  vector<string> few ({"2", "3"});
+  results = h1.find_many (few);
+  assert(*results[0] == 2 && results[1] == nullptr);
+  HashMap<string, int> h2;
+  results = h2.find_many (keys);
+  assert(std::count (results.begin (), results.end (), nullptr) == 1000);
+  assert(h2.find_many (vector<string> ()).empty ());
+}
+
+/**
+ * An input iterator over the words of a stream, as word/word pairs, for
+ * updates from ranges that can be walked only once.
+ */
+struct word_pair_iterator
+{
+  typedef std::input_iterator_tag iterator_category;
+  typedef pair<string, string> value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef const value_type *pointer;
+  typedef const value_type &reference;
+
+  std::istream *in;
+  value_type current;
+
+  explicit word_pair_iterator (std::istream *_in = nullptr): in (_in)
+  {
+    ++*this;
+  }
+
+  word_pair_iterator &operator++ ()
+  {
+    string word;
+    if (in != nullptr && *in >> word) current = value_type (word, word);
+    else in = nullptr;
+    return *this;
+  }
+
+  word_pair_iterator operator++ (int)
+  {
+    word_pair_iterator old = *this;
+    ++*this;
+    return old;
+  }
+
+  reference operator* () const { return current; }
+  pointer operator-> () const { return &current; }
+  bool operator== (const word_pair_iterator &other) const
+  { return in == other.in; }
+  bool operator!= (const word_pair_iterator &other) const
+  { return in != other.in; }
+};
+
+/**
+ * @tests:
+ * 0. a FilteredDictionary finds every key written through insert,
+ * operator[], update, merge and apply, and misses erased keys, also
+ * after an update from an input range and a try_erase
+ * 1. merge combines values, and apply counts only keys it erased as stale
+ * 2. most missing keys are filtered out, by the Bloom and the xor filter
+ * 3. freezing and thawing keeps every key, and stats report the filter
+ */
+void test_filtered_dictionary ()
+{
+  START_TEST;
+  FilteredDictionary d1;
+  assert(!d1.contains_key ("a") && d1.find ("a") == nullptr);
+  for (int i = 0; i < 500; i++) d1.insert ("k" + to_string (i), "v");
+  d1["k500"] = "w";
+  vector<pair<string, string>> range;
+  for (int i = 501; i < 1000; i++)
+    range.emplace_back ("k" + to_string (i), "u");
+  d1.update (range.begin (), range.end ());
+  Dictionary other;
+  other.insert ("k1000", "m");
+  d1.merge (std::move (other));
+  Dictionary target (d1.dictionary ());
+  target.insert ("k1001", "n");
+  d1.apply (d1.diff (target));
+  assert(d1.size () == 1002);
+  FilteredDictionary::Diff missing;
+  missing.removed.push_back ("absent");
+  size_t stale = d1.stats ().stale_items;
+  d1.apply (missing);
+  assert(d1.size () == 1002 && d1.stats ().stale_items == stale);
+  Dictionary more;
+  more.insert ("k1000", "!");
+  d1.merge (std::move (more), [] (string &existing, string &&incoming)
+  { existing += incoming; });
+  assert(d1.at ("k1000") == "m!" && d1.size () == 1002);
+  std::istringstream words ("w1 w2 w1");
+  FilteredDictionary d2;
+  d2.update (word_pair_iterator (&words), word_pair_iterator ());
+  assert(d2.size () == 2 && d2.contains_key ("w1") && d2.contains_key ("w2"));
+  assert(d2.try_erase ("w1") && !d2.contains_key ("w1"));
+  for (int i = 0; i < 1002; i++)
+    assert(d1.contains_key ("k" + to_string (i)));
+  assert(d1.at ("k500") == "w" && d1["k1001"] == "n");
+  d1.erase ("k0");
+  assert(!d1.erase ("k0", std::nothrow) && !d1.contains_key ("k0"));
+  int passed = 0;
+  for (int i = 0; i < 10000; i++)
+    if (d1.contains_key ("x" + to_string (i))) passed++;
+  assert(passed < 100);
+  FilterStats bloom_stats = d1.stats ();
+  assert(bloom_stats.filter_bytes > 0 && bloom_stats.items == 1001);
+  d1.freeze ();
+  assert(d1.is_frozen () && d1.stats ().kind == XOR_FILTER);
+  assert(d1.stats ().filter_bytes < bloom_stats.filter_bytes);
+  passed = 0;
+  for (int i = 1; i < 1002; i++)
+    assert(d1.contains_key ("k" + to_string (i)));
+  for (int i = 0; i < 10000; i++)
+    if (d1.contains_key ("x" + to_string (i))) passed++;
+  assert(passed < 100);
+  d1.insert ("k0", "back");
+  assert(!d1.is_frozen () && d1.get_or ("k0", "") == "back");
+  for (int i = 0; i < 1002; i++)
+    assert(d1.contains_key ("k" + to_string (i)));
+  for (int i = 0; i < 1002; i++) d1.erase ("k" + to_string (i));
+  assert(d1.empty () && d1.stats ().stale_items <= 64);
+  d1.clear ();
+  assert(!d1.contains_key ("k1"));
+}
+
+/**
+ * @tests:
+ * 0. a full BoundedCache evicts, and a recently read entry gets a second
+ * chance
+ * 1. hit, miss and eviction counters, erase and overwrite
+ * 2. the bytes budget, and an entry heavier than it, which doesn't
+ * displace the value cached for its key
+ * 3. a ConcurrentBoundedCache written by several threads stays in budget,
+ * and every entry the writers left holds the value written for its key
+ * 4. the shard budgets add up to the budgets of the cache
+ */
+void test_bounded_cache ()
+{
+  START_TEST;
+  BoundedCache<int, string> c1 (3);
+  c1.put (1, "a");
+  c1.put (2, "b");
+  c1.put (3, "c");
+  c1.put (4, "d");
+  assert(c1.size () == 3 && c1.stats ().evictions == 1);
+  assert(c1.get (1) == nullptr);
+  assert(*c1.get (2) == "b");
+  c1.put (5, "e");
+  string value;
+  assert(c1.get (2, value) && value == "b" && c1.get (3) == nullptr);
+  assert(c1.size () == 3 && c1.stats ().evictions == 2);
+  c1.put (2, "B");
+  assert(*c1.get (2) == "B" && c1.size () == 3);
+  assert(c1.erase (2) && !c1.erase (2) && c1.size () == 2);
+  CacheStats stats = c1.stats ();
+  assert(stats.hits == 3 && stats.misses == 2 && stats.entries == 2);
+  assert(stats.hit_rate () == 0.6);
+  BoundedCache<string, string> c2 (100, 10, [] (const string &key,
+                                                const string &value)
+  { return key.size () + value.size (); });
+  c2.put ("a", "1234");
+  c2.put ("b", "1234");
+  assert(c2.size () == 2 && c2.stats ().bytes == 10);
+  c2.put ("c", "12");
+  assert(c2.size () == 2 && c2.stats ().bytes <= 10);
+  assert(!c2.put ("d", "123456789012") && c2.get ("d") == nullptr);
+  assert(!c2.put ("c", "123456789012") && *c2.get ("c") == "12");
+  bool thrown = false;
+  try
+  {
+    BoundedCache<int, int> c3 (0);
+  }
+  catch (std::invalid_argument &err)
+  {
+    thrown = true;
+  }
+  assert(thrown);
+  ConcurrentBoundedCache<int, int> c4 (1000, 8);
+  vector<std::thread> threads;
+  for (int t = 0; t < 4; t++)
+    threads.emplace_back ([&c4, t] ()
+    {
+      for (int i = 0; i < 5000; i++)
+      {
+        c4.put (t * 5000 + i, i);
+        int value;
+        c4.get (t * 5000 + i / 2, value);
+      }
+    });
+  for (auto &thread : threads) thread.join ();
+  assert(c4.size () <= 1000 && c4.size () > 0);
+  assert(c4.stats ().hits + c4.stats ().misses == 20000);
+  size_t present = 0;
+  for (int key = 0; key < 20000; key++)
+  {
+    int found;
+    if (c4.get (key, found))
+    {
+      assert(found == key % 5000);
+      present++;
+    }
+  }
+  assert(present == c4.size ());
+  c4.clear ();
+  assert(c4.size () == 0);
+  ConcurrentBoundedCache<int, int> c5 (100, 64, 100,
+                                       [] (const int &, const int &)
+                                       { return (size_t) 1; });
+  for (int key = 0; key < 10000; key++) c5.put (key, key);
+  assert(c5.shard_count () == 64 && c5.size () == 100);
+}
+
+/**
+ * A clock the tests move by hand.
+ */
+struct manual_clock
+{
+  typedef std::chrono::seconds duration;
+  typedef duration::rep rep;
+  typedef duration::period period;
+  typedef std::chrono::time_point<manual_clock> time_point;
+  static const bool is_steady = true;
+  static time_point current;
+
+  static time_point now ()
+  { return current; }
+};
+manual_clock::time_point manual_clock::current;
+
+/**
+ * @tests:
+ * 0. expired entries are never returned, and are erased lazily by find,
+ * erase and insert
+ * 1. expire_after extends a live entry, put replaces an entry
+ * 2. sweep erases in bounded steps and shrinks the map only when the
+ * sweep completes
+ */
+void test_expiring_hash_map ()
+{
+  START_TEST;
+  typedef ExpiringHashMap<string, int, manual_clock> session_map;
+  session_map h1;
+  h1.insert ("forever", 0);
+  h1.insert ("short", 1, std::chrono::seconds (10));
+  h1.insert ("long", 2, std::chrono::seconds (100));
+  assert(!h1.insert ("short", 5, std::chrono::seconds (10)));
+  manual_clock::current += std::chrono::seconds (10);
+  assert(!h1.contains_key ("short") && h1.size () == 3);
+  const session_map &view = h1;
+  assert(view.find ("short") == nullptr && h1.size () == 3);
+  assert(h1.find ("short") == nullptr && h1.size () == 2);
+  assert(h1.insert ("short", 3, std::chrono::seconds (10)));
+  assert(h1.at ("short") == 3);
+  assert(h1.expire_after ("long", std::chrono::seconds (1000)));
+  manual_clock::current += std::chrono::seconds (500);
+  assert(h1.at ("long") == 2 && h1.at ("forever") == 0);
+  assert(!h1.erase ("short") && h1.size () == 2);
+  assert(!h1.expire_after ("short", std::chrono::seconds (1)));
+  h1.put ("long", 4, std::chrono::seconds (1));
+  assert(*h1.find ("long") == 4);
+  bool thrown = false;
+  try
+  {
+    h1.at ("short");
+  }
+  catch (std::runtime_error &err)
+  {
+    thrown = true;
+  }
+  assert(thrown);
+
+  session_map h2;
+  for (int i = 0; i < 1000; i++)
+    h2.insert (to_string (i), i, std::chrono::seconds (i < 900 ? 1 : 100));
+  size_t full_capacity = h2.capacity ();
+  manual_clock::current += std::chrono::seconds (1);
+  size_t erased = h2.sweep (8);
+  assert(h2.sweep_in_progress () && h2.capacity () == full_capacity);
+  assert(!h2.erase ("1") && h2.capacity () == full_capacity);
+  while (h2.sweep_in_progress ()) erased += h2.sweep (8);
+  assert(erased + 1 == 900 && h2.size () == 100);
+  assert(h2.capacity () < full_capacity);
+  for (int i = 900; i < 1000; i++) assert(h2.contains_key (to_string (i)));
+  manual_clock::current += std::chrono::seconds (100);
+  assert(h2.sweep_all () == 100 && h2.empty ());
+  h2.clear ();
+  assert(h2.sweep (8) == 0);
+}
+
+/**
+ * @tests:
+ * 0. values of a key are kept in insertion order, while other keys grow
+ * 1. count, erase of all the values of a key, and a missing key
+ * 2. values survive compaction after many erases
+ */
+void test_multi_dictionary ()
+{
+  START_TEST;
+  MultiDictionary m1 ({"tag", "other", "tag"}, {"1", "x", "2"});
+  for (int i = 3; i < 20; i++)
+  {
+    m1.insert ("tag", to_string (i));
+    m1.insert ("other", "y");
+  }
+  assert(m1.size () == 37 && m1.key_count () == 2);
+  assert(m1.count ("tag") == 19 && m1.count ("other") == 18);
+  auto range = m1.equal_range ("tag");
+  assert(range.second - range.first == 19);
+  for (int i = 1; i < 20; i++) assert(range.first[i - 1] == to_string (i));
+  range = m1.equal_range ("none");
+  assert(range.first == range.second && m1.count ("none") == 0);
+  assert(m1.erase ("other") == 18 && m1.erase ("other") == 0);
+  assert(!m1.contains_key ("other") && m1.size () == 19);
+  MultiDictionary m2;
+  for (int i = 0; i < 3000; i++)
+    for (int j = 0; j <= i % 5; j++) m2.insert (to_string (i), to_string (j));
+  for (int i = 0; i < 3000; i += 2) m2.erase (to_string (i));
+  assert(m2.key_count () == 1500);
+  for (int i = 1; i < 3000; i += 2)
+  {
+    range = m2.equal_range (to_string (i));
+    assert((int) (range.second - range.first) == i % 5 + 1);
+    assert(range.second[-1] == to_string (i % 5));
+  }
+  m2.compact ();
+  m2.insert ("1", "more");
+  assert(m2.count ("1") == 3 && m2.equal_range ("1").first[2] == "more");
+  m2.clear ();
+  assert(m2.empty () && m2.key_count () == 0);
+  bool thrown = false;
+  try
+  {
+    MultiDictionary m3 ({"a"}, {});
+  }
+  catch (std::length_error &err)
+  {
+    thrown = true;
+  }
+  assert(thrown);
+}
+
+/**
+ * @tests:
+ * 0. sizes and capacities go past 2^31 buckets, reserved on an empty map
+ * so the buckets array isn't allocated
+ */
+void test_large_capacity ()
+{
+  START_TEST;
+  HashMap<int, int> h1;
+  h1.reserve (3000000000ULL);
+  assert(h1.capacity () == (size_t) 1 << 32 && h1.size () == 0);
+  assert(h1.capacity () > (size_t) INT32_MAX && h1.empty ());
+  assert(!h1.contains_key (1) && h1.find (1) == nullptr);
+  assert(h1.begin () == h1.end ());
+  h1.reserve (10);
+  assert(h1.capacity () == (size_t) 1 << 32);
+}
+
+/**
+ * @tests:
+ * 0. a StringPool gives equal strings one handle, and keeps references
+ * valid as it grows
+ * 1. an InterningDictionary stores and replaces values, with and without
+ * interned keys, and dictionaries can share a pool
+ * 2. stats count the deduplicated strings
+ */
+void test_string_pool ()
+{
+  START_TEST;
+  StringPool pool;
+  string_handle active = pool.intern ("ACTIVE");
+  const string &active_text = pool[active];
+  for (int i = 0; i < 1000; i++) pool.intern ("status " + to_string (i));
+  assert(pool.intern (string ("ACTIVE")) == active && active_text == "ACTIVE");
+  string_handle found;
+  assert(pool.find ("status 7", found) && pool[found] == "status 7");
+  assert(!pool.find ("missing", found) && pool.size () == 1001);
+  auto shared = std::make_shared<StringPool> ();
+  InterningDictionary<> d1 (shared);
+  InterningDictionary<true> d2 (shared);
+  for (int i = 0; i < 100; i++)
+  {
+    d1.insert ("user" + to_string (i), i % 2 ? "US" : "a long status string");
+    d2.insert ("user" + to_string (i), "US");
+  }
+  assert(!d1.insert ("user1", "FR") && d1.at ("user1") == "US");
+  d1.set ("user1", "FR");
+  assert(d1.at ("user1") == "FR");
+  assert(*d1.find ("user2") == "a long status string");
+  assert(d1.find ("nobody") == nullptr && !d2.contains_key ("nobody"));
+  assert(d2.at ("user5") == "US" && &d2.at ("user5") == &d1.at ("user3"));
+  assert(d2.erase ("user5") && !d2.erase ("user5") && d2.size () == 99);
+  bool thrown = false;
+  try
+  {
+    d2.at ("user5");
+  }
+  catch (std::runtime_error &err)
+  {
+    thrown = true;
+  }
+  assert(thrown);
+  InterningStats stats = d1.stats ();
+  assert(stats.entries == 100 && stats.distinct_strings == 103);
+  assert(stats.handle_bytes == 400 && stats.unpooled_bytes > 100 * 32);
+  assert(d2.stats ().handle_bytes == 99 * 8);
+}
+
+/**
+ * @tests:
+ * 0. a BTreeIndex stays sorted through many splits, erases and merges,
+ * checked against a sorted vector
+ * 1. lower_bound and prefix_range, including a prefix ending in 0xFF
+ * 2. an OrderedDictionary keeps its index in sync with insert, operator[],
+ * update, also from an input range, merge, apply, erase and try_erase
+ */
+void test_ordered_dictionary ()
+{
+  START_TEST;
+  BTreeIndex i1;
+  vector<string> expected;
+  for (int i = 0; i < 5000; i++)
+  {
+    string key = to_string (i * 7919 % 5000);
+    assert(i1.insert (key));
+    expected.push_back (key);
+  }
+  assert(!i1.insert ("42") && i1.size () == 5000);
+  std::sort (expected.begin (), expected.end ());
+  assert(std::equal (i1.begin (), i1.end (), expected.begin ()));
+  for (int i = 0; i < 5000; i += 3) assert(i1.erase (to_string (i)));
+  assert(!i1.erase ("0") && !i1.erase ("none"));
+  expected.erase (std::remove_if (expected.begin (), expected.end (),
+                                  [] (const string &key)
+                                  { return stoi (key) % 3 == 0; }),
+                  expected.end ());
+  assert(i1.size () == expected.size ());
+  assert(std::equal (i1.begin (), i1.end (), expected.begin ()));
+  assert(*i1.lower_bound ("4999") == "4999");
+  assert(*i1.lower_bound ("4998") == "4999");
+  assert(i1.lower_bound ("5") != i1.end () && *i1.lower_bound ("5") == "5");
+  assert(i1.lower_bound ("a") == i1.end ());
+  auto range = i1.prefix_range ("49");
+  assert(std::distance (range.first, range.second)
+         == std::count_if (expected.begin (), expected.end (),
+                           [] (const string &key)
+                           { return key.find ("49") == 0; }));
+  for (auto it = range.first; it != range.second; ++it)
+    assert(it->find ("49") == 0);
+  i1.insert (string ("a\xff"));
+  i1.insert (string ("a\xff\x01"));
+  range = i1.prefix_range (string ("a\xff"));
+  assert(std::distance (range.first, range.second) == 2);
+  for (int i = 0; i < 5000; i++) i1.erase (to_string (i));
+  assert(i1.size () == 2 && *i1.begin () == string ("a\xff"));
+  i1.clear ();
+  assert(i1.begin () == i1.end ());
+
+  OrderedDictionary d1 ({"user:3", "user:1"}, {"c", "a"});
+  d1.insert ("user:2", "b");
+  d1["admin:1"] = "x";
+  vector<pair<string, string>> more ({{"user:4", "d"}, {"user:1", "A"}});
+  d1.update (more.begin (), more.end ());
+  Dictionary other;
+  other.insert ("guest:1", "g");
+  d1.merge (std::move (other));
+  Dictionary target (d1.dictionary ());
+  target.insert ("user:5", "e");
+  target.insert ("user:6", "f");
+  target.erase ("guest:1");
+  d1.apply (d1.diff (target));
+  d1.erase ("user:3");
+  assert(!d1.erase ("nobody", std::nothrow));
+  assert(d1.try_erase ("user:6") && !d1.try_erase ("user:6"));
+  assert(!d1.contains_key ("user:6"));
+  vector<string> keys (d1.ordered_begin (), d1.ordered_end ());
+  assert(keys == vector<string> ({"admin:1", "user:1", "user:2", "user:4",
+                                  "user:5"}));
+  for (const auto &key : keys) assert(d1.at (key) == d1.dictionary ().at (key));
+  auto users = d1.prefix_range ("user:");
+  assert(std::distance (users.first, users.second) == 4);
+  assert(d1.at (*users.first) == "A" && *d1.lower_bound ("user:3") == "user:4");
+  d1.clear ();
+  assert(d1.ordered_begin () == d1.ordered_end ());
+  std::istringstream words ("w2 w1 w2");
+  OrderedDictionary d2;
+  d2.update (word_pair_iterator (&words), word_pair_iterator ());
+  keys.assign (d2.ordered_begin (), d2.ordered_end ());
+  assert(keys == vector<string> ({"w1", "w2"}) && d2.size () == 2);
+}
+
+/**
+ * A fresh directory under /tmp for durable dictionaries, removed with
+ * remove_dictionary_directory.
+ */
+string make_dictionary_directory ()
+{
+  char path[] = "/tmp/durable_testXXXXXX";
+  if (mkdtemp (path) == nullptr) throw runtime_error ("mkdtemp failed");
+  return path;
+}
+
+void remove_dictionary_directory (const string &path)
+{
+  for (const char *file : {WAL_FILE, SNAPSHOT_FILE, SNAPSHOT_TEMP_FILE})
+  {
+    ::unlink ((path + file).c_str ());
+  }
+  ::rmdir (path.c_str ());
+}
+
+string read_binary_file (const string &path)
+{
+  std::ifstream in (path, std::ios::binary);
+  return string (std::istreambuf_iterator<char> (in),
+                 std::istreambuf_iterator<char> ());
+}
+
+void write_binary_file (const string &path, const string &data)
+{
+  std::ofstream out (path, std::ios::binary | std::ios::trunc);
+  out << data;
+}
+
+/**
+ * @tests: 0. A durable dictionary recovers its mutations from the log and
+ * the snapshot when reopened, with and without group commit.
+ * 1. Cutting the log at every byte, as a crash during a write would,
+ * recovers exactly the mutations whose records are whole.
+ * 2. A corrupt record ends the recovery at the record before it, and the
+ * log is cut there so new mutations follow valid records.
+ */
+void test_durable_dictionary ()
+{
+  START_TEST;
+  string dir = make_dictionary_directory ();
+  {
+    DurableDictionary d1 (dir);
+    assert(d1.empty ());
+    assert(d1.insert ("a", "1") && !d1.insert ("a", "2"));
+    d1["b"] = "2";
+    d1.set ("c", "3");
+    assert(d1.erase ("c") && !d1.erase ("c", std::nothrow));
+    bool thrown = false;
+    try { d1.erase ("c"); } catch (InvalidKey &) { thrown = true; }
+    assert(thrown);
+    assert((const string &) d1["b"] == "2" && d1.size () == 2);
+  }
+  {
+    DurableDictionary d1 (dir);
+    assert(d1.size () == 2 && d1.at ("a") == "1" && d1.at ("b") == "2");
+    d1.checkpoint ();
+    assert(d1.wal_bytes () == 0);
+    d1.set ("a", "one");
+    d1.erase ("b");
+  }
+  {
+    WalOptions options;
+    options.fsync_policy = FSYNC_NEVER;
+    options.group_records = 16;
+    DurableDictionary d1 (dir, options);
+    assert(d1.size () == 1 && d1.at ("a") == "one" && !d1.contains_key ("b"));
+    for (int i = 0; i < 100; i++) d1.set (to_string (i), to_string (i * i));
+  }
+  {
+    DurableDictionary d1 (dir);
+    assert(d1.size () == 101 && d1.at ("99") == "9801");
+  }
+  remove_dictionary_directory (dir);
+
+  //The state and the log size after each committed mutation.
+  dir = make_dictionary_directory ();
+  vector<Dictionary> states (1);
+  vector<size_t> log_sizes (1, 0);
+  {
+    WalOptions options;
+    options.fsync_policy = FSYNC_NEVER;
+    DurableDictionary d1 (dir, options);
+    for (int i = 0; i < 40; i++)
+    {
+      if (i % 5 == 4) d1.erase (to_string ((i - 2) % 7), std::nothrow);
+      else d1.set (to_string (i % 7), string (i, 'x'));
+      states.push_back (d1.dictionary ());
+      log_sizes.push_back (d1.wal_bytes ());
+    }
+  }
+  string log = read_binary_file (dir + WAL_FILE);
+  assert(log.size () == log_sizes.back ());
+  for (size_t cut = 0; cut <= log.size (); cut++)
+  {
+    write_binary_file (dir + WAL_FILE, log.substr (0, cut));
+    size_t whole = 0;
+    while (whole + 1 < log_sizes.size () && log_sizes[whole + 1] <= cut)
+      whole++;
+    DurableDictionary d1 (dir);
+    assert(d1.dictionary () == states[whole]);
+    assert(d1.wal_bytes () == log_sizes[whole]);
+  }
+
+  string corrupt = log;
+  corrupt[log_sizes[10] + WAL_RECORD_HEADER_BYTES] ^= 1;
+  write_binary_file (dir + WAL_FILE, corrupt);
+  {
+    DurableDictionary d1 (dir);
+    assert(d1.dictionary () == states[10]);
+    d1.set ("after", "corruption");
+  }
+  {
+    DurableDictionary d1 (dir);
+    Dictionary expected = states[10];
+    expected["after"] = "corruption";
+    assert(d1.dictionary () == expected);
+  }
+  remove_dictionary_directory (dir);
+}
+
+/**
+ * @tests: 0. Maps of trivially copyable types and dictionaries survive a
+ * round trip through a stream and through a buffer, and images can be
+ * concatenated.
+ * 1. The loaded map is sized for its items up front, also when it was
+ * grown for more before.
+ * 2. Images that are cut short, corrupt or of other types are rejected
+ * without touching the map, also from a stream whose header claims a
+ * payload too large to allocate.
+ * 3. OrderedDictionary and FilteredDictionary index the loaded keys.
+ */
+void test_serialization ()
+{
+  START_TEST;
+  HashMap<int, double> m1;
+  for (int i = 0; i < 1000; i++) m1.insert (i * 31, i / 2.0);
+  std::stringstream stream;
+  m1.serialize (stream);
+  HashMap<int, double> m2;
+  m2.insert (-1, 0);
+  m2.deserialize (stream);
+  assert(m2 == m1 && !m2.contains_key (-1));
+  HashMap<int, double> m3;
+  m3.reserve (1000);
+  assert(m2.capacity () == m3.capacity ());
+  HashMap<int, double> small;
+  small.insert (1, 0.5);
+  small.insert (2, 1.0);
+  vector<char> small_image;
+  small.serialize (small_image);
+  m2.deserialize (small_image.data (), small_image.size ());
+  assert(m2 == small && m2.capacity () == STARTING_HASH_CAPACITY);
+
+  Dictionary d1;
+  for (int i = 0; i < 500; i++)
+    d1.insert ("key" + to_string (i), string (i, 'v'));
+  d1.insert ("", "");
+  vector<char> buffer;
+  d1.serialize (buffer);
+  size_t first_image = buffer.size ();
+  Dictionary ().serialize (buffer);
+  Dictionary d2;
+  assert(d2.deserialize (buffer.data (), buffer.size ()) == first_image);
+  assert(d2 == d1 && d2.at ("key499") == string (499, 'v'));
+  d2.deserialize (buffer.data () + first_image, buffer.size () - first_image);
+  assert(d2.empty ());
+
+  int rejected = 0;
+  auto expect_rejected = [&rejected] (Dictionary &target,
+                                     const vector<char> &image)
+  {
+    try { target.deserialize (image.data (), image.size ()); }
+    catch (std::runtime_error &) { rejected++; }
+  };
+  d2 = d1;
+  vector<char> image (buffer.begin (), buffer.begin () + first_image);
+  vector<char> corrupt = image;
+  corrupt[SERIAL_HEADER_BYTES + 10] ^= 1;
+  expect_rejected (d2, corrupt);
+  expect_rejected (d2, vector<char> (image.begin (), image.end () - 1));
+  expect_rejected (d2, vector<char> (image.begin (), image.begin () + 10));
+  vector<char> other_type;
+  m1.serialize (other_type);
+  expect_rejected (d2, other_type);
+  vector<char> overcounted = image;
+  uint64_t count = 1ULL << 60;
+  std::memcpy (&overcounted[4 * sizeof (uint32_t)], &count, sizeof (count));
+  expect_rejected (d2, overcounted);
+  assert(rejected == 5 && d2 == d1);
+  std::stringstream cut (string (image.begin (), image.end () - 5));
+  bool thrown = false;
+  try { d2.deserialize (cut); } catch (std::runtime_error &) { thrown = true; }
+  assert(thrown && d2 == d1);
+  for (uint64_t payload : {1ULL << 42, ~0ULL, ~0ULL - SERIAL_HEADER_BYTES})
+  {
+    string huge (image.begin (), image.end ());
+    std::memcpy (&huge[SERIAL_HEADER_BYTES - sizeof (payload)], &payload,
+                 sizeof (payload));
+    std::stringstream claimed (huge);
+    thrown = false;
+    try { d2.deserialize (claimed); }
+    catch (std::runtime_error &) { thrown = true; }
+    assert(thrown && d2 == d1);
+  }
+
+  OrderedDictionary o1;
+  o1.deserialize (image.data (), image.size ());
+  assert(o1 == d1 && *o1.ordered_begin () == "");
+  assert(*o1.lower_bound ("key5") == "key5");
+  FilteredDictionary f1;
+  f1.deserialize (image.data (), image.size ());
+  assert(f1.contains_key ("key7") && !f1.contains_key ("key500"));
+}
+
+/**
+ * @tests: 0. A striped map behaves like a HashMap on one thread, growing
+ * and shrinking through the escalated path.
+ * 1. Concurrent update_if_present calls on a few hot keys lose no update.
+ * 2. Concurrent insertions and erasures of distinct keys, with rehashes
+ * in between, leave exactly the expected keys.
+ */
+void test_striped_hash_map ()
+{
+  START_TEST;
+  StripedHashMap<int, long> m1 (5);
+  assert(m1.stripe_count () == 8 && m1.empty ());
+  for (int i = 0; i < 1000; i++) assert(m1.insert (i, i));
+  assert(!m1.insert (7, 0) && m1.size () == 1000);
+  assert(m1.update_if_present (7, [] (long &value) { value += 100; }));
+  assert(!m1.update_if_present (1000, [] (long &value) { value++; }));
+  long value = 0;
+  assert(m1.get (7, value) && value == 107 && m1.get_or (1000, -1) == -1);
+  for (int i = 0; i < 990; i++) assert(m1.erase (i));
+  assert(!m1.erase (0) && m1.size () == 10 && m1.contains_key (995));
+  assert(m1.insert_or_update (5, 1, [] (long &curr) { curr++; }));
+  assert(!m1.insert_or_update (5, 1, [] (long &curr) { curr++; }));
+  assert(m1.get_or (5, 0) == 2);
+  HashMap<int, long> copy = m1.snapshot ();
+  assert(copy.size () == 11 && copy.at (999) == 999);
+  m1.clear ();
+  assert(m1.empty () && !m1.contains_key (999));
+
+  const int threads = 8;
+  const int rounds = 20000;
+  StripedHashMap<int, long> counters;
+  for (int key = 0; key < 4; key++) counters.insert (key, 0);
+  run_on_threads (threads, [&counters] (unsigned thread)
+  {
+    for (int i = 0; i < rounds; i++)
+    {
+      counters.update_if_present ((int) (i + thread) % 4,
+                                  [] (long &curr) { curr++; });
+      counters.insert_or_update (100 + i % 16, 1, [] (long &curr) { curr++; });
+    }
+  });
+  long total = 0;
+  for (int key = 0; key < 4; key++) total += counters.get_or (key, 0);
+  assert(total == (long) threads * rounds);
+  total = 0;
+  for (int key = 100; key < 116; key++) total += counters.get_or (key, 0);
+  assert(total == (long) threads * rounds);
+
+  StripedHashMap<int, long> m2;
+  run_on_threads (threads, [&m2] (unsigned thread)
+  {
+    for (int i = 0; i < 5000; i++) m2.insert ((int) thread * 10000 + i, i);
+    for (int i = 0; i < 5000; i += 2) m2.erase ((int) thread * 10000 + i);
+  });
+  assert(m2.size () == threads * 2500);
+  HashMap<int, long> contents = m2.snapshot ();
+  assert(contents.size () == m2.size ());
+  for (int thread = 0; thread < threads; thread++)
+  {
+    assert(contents.contains_key (thread * 10000 + 1)
+           && !contents.contains_key (thread * 10000 + 2));
+  }
+}
+
+/**
+ * @tests: 0. increment counts new and existing keys, and get, erase and
+ * top_k see the counts.
+ * 1. Concurrent increments of hot and new keys, direct and through local
+ * buffers, lose no count.
+ */
+void test_counter_map ()
+{
+  START_TEST;
+  CounterMap<string> c1;
+  assert(c1.increment ("a") == 1 && c1.increment ("a", 4) == 5);
+  assert(c1.increment ("b", -2) == -2);
+  assert(c1.get ("a") == 5 && c1.get ("c") == 0);
+  for (int i = 0; i < 100; i++) c1.increment ("k" + to_string (i), i);
+  assert(c1.size () == 102);
+  auto top = c1.top_k (3);
+  assert(top.size () == 3 && top[0].first == "k99" && top[0].second == 99);
+  assert(top[1].first == "k98" && top[2].first == "k97");
+  assert(c1.top_k (0).empty () && c1.top_k (1000).size () == 102);
+  assert(c1.top_k (1000).back ().first == "b");
+  assert(c1.erase ("a") && !c1.erase ("a") && c1.get ("a") == 0);
+  HashMap<string, int64_t> counts = c1.snapshot ();
+  assert(counts.size () == 101 && counts.at ("k50") == 50);
+  c1.clear ();
+  assert(c1.empty () && c1.top_k (5).empty ());
+
+  const int threads = 8;
+  const int rounds = 20000;
+  CounterMap<int> c2;
+  run_on_threads (threads, [&c2] (unsigned thread)
+  {
+    CounterMap<int>::local_buffer buffer (c2, 64);
+    for (int i = 0; i < rounds; i++)
+    {
+      c2.increment (i % 8);
+      c2.increment (1000 + i);
+      buffer.increment (100 + (i * 7 + (int) thread) % 200, 2);
+    }
+  });
+  for (int key = 0; key < 8; key++)
+    assert(c2.get (key) == threads * rounds / 8);
+  assert(c2.get (1000) == threads && c2.get (1000 + rounds - 1) == threads);
+  int64_t buffered = 0;
+  for (int key = 100; key < 300; key++) buffered += c2.get (key);
+  assert(buffered == (int64_t) threads * rounds * 2);
+  assert(c2.size () == 8 + rounds + 200);
+  assert(c2.top_k (8).back ().second == threads * rounds / 8);
+}
+
+/**
+ * @tests: 0. A write buffer shows its writes to its own thread at once and
+ * to others once flushed, by size, by time or explicitly.
+ * 1. Erasing through a buffer drops its pending write.
+ * 2. Buffers of many threads merge every write, the last one per key
+ * winning within a thread.
+ * 3. A batch that only rewrites keys doesn't grow the dictionary.
+ */
+void test_buffered_dictionary ()
+{
+  START_TEST;
+  BufferedDictionary d1;
+  BufferPolicy policy;
+  policy.max_keys = 3;
+  policy.max_delay = std::chrono::hours (1);
+  string value;
+  {
+    BufferedDictionary::write_buffer b1 (d1, policy);
+    b1.set ("a", "1");
+    b1.set ("a", "2");
+    b1.set ("b", "1");
+    assert(b1.get ("a", value) && value == "2" && b1.pending_size () == 2);
+    assert(!d1.contains_key ("a") && d1.empty ());
+    b1.set ("c", "1");
+    assert(b1.pending_size () == 0 && d1.size () == 3);
+    assert(d1.get ("a", value) && value == "2");
+    b1.set ("a", "3");
+    assert(b1.get ("a", value) && value == "3");
+    assert(d1.get ("a", value) && value == "2");
+    assert(b1.erase ("a") && !b1.contains_key ("a") && !d1.contains_key ("a"));
+    assert(!b1.erase ("a"));
+    b1.set ("d", "1");
+    b1.flush ();
+    assert(d1.contains_key ("d") && b1.pending_size () == 0);
+    b1.set ("e", "1");
+  }
+  assert(d1.size () == 4 && d1.contains_key ("e"));
+
+  policy.max_keys = 1000;
+  policy.max_delay = std::chrono::milliseconds (0);
+  {
+    BufferedDictionary::write_buffer b1 (d1, policy);
+    b1.set ("f", "1");
+    assert(d1.contains_key ("f"));
+  }
+
+  const int threads = 8;
+  BufferedDictionary d2;
+  run_on_threads (threads, [&d2] (unsigned thread)
+  {
+    BufferPolicy small;
+    small.max_keys = 100;
+    BufferedDictionary::write_buffer buffer (d2, small);
+    for (int i = 0; i < 5000; i++)
+    {
+      buffer.set ("shared" + to_string (i % 50), to_string (thread));
+      buffer.set (to_string (thread) + ":" + to_string (i), to_string (i));
+      buffer.set (to_string (thread) + ":" + to_string (i % 10), "last");
+    }
+  });
+  assert(d2.size () == 50 + threads * 5000);
+  Dictionary contents = d2.snapshot ();
+  for (int thread = 0; thread < threads; thread++)
+  {
+    assert(contents.at (to_string (thread) + ":4999") == "4999");
+    assert(contents.at (to_string (thread) + ":7") == "last");
+  }
+  assert(stoi (contents.at ("shared7")) < threads);
+
+  BufferedDictionary d3;
+  {
+    BufferedDictionary::write_buffer b1 (d3);
+    for (int i = 0; i < 700; i++) b1.set (to_string (i), "x");
+  }
+  size_t capacity = d3.snapshot ().capacity ();
+  {
+    BufferedDictionary::write_buffer b1 (d3);
+    for (int i = 0; i < 700; i++) b1.set (to_string (i), "y");
+  }
+  assert(d3.size () == 700 && d3.snapshot ().capacity () == capacity);
+  assert(d3.get ("5", value) && value == "y");
+}
+
+/**
+ * @tests: 0. The parallel constructors build the same map as the
+ * sequential ones, later duplicates winning, on one or many threads.
+ * 1. The capacity is the sequential constructor's, also when most keys
+ * are duplicates.
+ * 2. Vectors of different sizes throw length_error.
+ */
+void test_parallel_constructor ()
+{
+  START_TEST;
+  vector<int> keys;
+  vector<int> values;
+  for (int i = 0; i < 200000; i++)
+  {
+    keys.push_back ((i * 7919) % 150000);
+    values.push_back (i);
+  }
+  HashMap<int, int> sequential (keys, values);
+  for (unsigned threads : {1u, 4u, 0u})
+  {
+    HashMap<int, int> parallel (parallel_execution, keys, values, threads);
+    assert(parallel == sequential && parallel.size () == 150000);
+    assert(parallel.capacity () == sequential.capacity ());
+  }
+  vector<int> same_key (100000, 7);
+  vector<int> counts (values.begin (), values.begin () + 100000);
+  HashMap<int, int> one_key (parallel_execution, same_key, counts, 4);
+  assert(one_key.size () == 1 && one_key.at (7) == 99999);
+  assert(one_key.capacity () == STARTING_HASH_CAPACITY);
+  HashMap<int, int> one_key_sequential (same_key, counts);
+  assert(one_key.capacity () == one_key_sequential.capacity ());
+  HashMap<int, int> all_threads (parallel_execution, keys, values);
+  assert(all_threads.at (7919) == 150001);
+
+  vector<string> words;
+  vector<string> meanings;
+  for (int i = 0; i < 5000; i++)
+  {
+    words.push_back (to_string (i % 3000));
+    meanings.push_back (to_string (i));
+  }
+  Dictionary d1 (words, meanings);
+  Dictionary d2 (parallel_execution, words, meanings, 3);
+  assert(d1 == d2 && d2.at ("5") == "3005");
+  Dictionary d3 (parallel_execution, vector<string> (), vector<string> ());
+  assert(d3.empty ());
+
+  bool thrown = false;
+  try
+  {
+    HashMap<int, int> bad (parallel_execution, keys, vector<int> (3));
+  }
+  catch (std::length_error &)
+  {
+    thrown = true;
+  }
+  assert(thrown);
+}
+
+/**
+ * Checks that a hash_batch kernel hashes every key as hash<KeyT> does, for
+ * batches of every size that fits in keys, starting at aligned and
+ * unaligned addresses.
+ */
+template<class KeyT, class Kernel>
+void check_hash_kernel (const vector<KeyT> &keys, const Kernel &kernel)
+{
+  vector<size_t> hashes (keys.size ());
+  for (size_t first = 0; first < 3; first++)
+  {
+    for (size_t count = 0; count + first <= keys.size (); count++)
+    {
+      std::fill (hashes.begin (), hashes.end (), 0xDEAD);
+      kernel (keys.data () + first, count, hashes.data () + first);
+      for (size_t i = 0; i < keys.size (); i++)
+      {
+        bool hashed = i >= first && i < first + count;
+        assert(hashes[i] == (hashed ? hash<KeyT> {} (keys[i]) : 0xDEAD));
+      }
+    }
+  }
+}
+
+//Keys without SIMD kernels of their own.
+template<class KeyT>
+void check_hash_kernels (const vector<KeyT> &, std::false_type)
+{}
+
+//32-bit integers, whose kernels the CPU may or may not have.
+template<class KeyT>
+void check_hash_kernels (const vector<KeyT> &keys, std::true_type)
+{
+#if defined (__GLIBCXX__) && defined (__x86_64__)
+  check_hash_kernel (keys, hash_batch<KeyT>::scalar);
+  if (__builtin_cpu_supports ("avx2"))
+  {
+    check_hash_kernel (keys, hash_batch<KeyT>::avx2);
+  }
+  if (__builtin_cpu_supports ("avx512f"))
+  {
+    check_hash_kernel (keys, hash_batch<KeyT>::avx512);
+  }
+#endif
+}
+
+template<class KeyT>
+void check_hash_batch ()
+{
+  vector<KeyT> keys;
+  for (int i = 0; i < 45; i++)
+  {
+    keys.push_back ((KeyT) ((i % 2 == 0 ? -1 : 1) * i * 104729));
+  }
+  keys[7] = std::numeric_limits<KeyT>::min ();
+  keys[8] = std::numeric_limits<KeyT>::max ();
+  check_hash_kernel (keys, hash_batch<KeyT>::apply);
+  check_hash_kernels (keys, std::integral_constant<bool, sizeof (KeyT) == 4>
+      ());
+}
+
+/**
+ * @tests: 0. Every hash_batch kernel the CPU has, and the scalar one, hash
+ * signed and unsigned integers of 32 and 64 bits as std::hash does,
+ * including the extremes and the tails of batches.
+ * 1. Other key types, e.g. strings, are hashed one by one as std::hash does.
+ * 2. find_many and the parallel constructor, which hash in batches, agree
+ * with find.
+ */
+void test_hash_batch ()
+{
+  START_TEST;
+  check_hash_batch<int> ();
+  check_hash_batch<unsigned int> ();
+  check_hash_batch<int64_t> ();
+  check_hash_batch<uint64_t> ();
+  check_hash_batch<short> ();
+  vector<string> words = {"", "a", "short", "a somewhat longer key string"};
+  for (int i = 0; i < 30; i++)
+  {
+    words.push_back (string (i, 'x') + to_string (i));
+  }
+  check_hash_kernel (words, hash_batch<string>::apply);
+
+  vector<int> keys;
+  vector<int> values;
+  for (int i = -5000; i < 5000; i++)
+  {
+    keys.push_back (i * 7);
+    values.push_back (i);
+  }
+  HashMap<int, int> map (parallel_execution, keys, values, 3);
+  keys.push_back (1);
+  vector<const int *> found = map.find_many (keys);
+  for (size_t i = 0; i < keys.size (); i++)
+  {
+    assert(found[i] == map.find (keys[i]));
+  }
+  assert(found.back () == nullptr && *found[0] == -5000);
+}
+
 int main ()
 {
   typedef void (*test_func) ();
@@ -1053,7 +2628,32 @@ int main ()
       test_invalid_key_exception,
       test_capacity_edge_cases,
       test_special_key_types,
-      test_const_correctness
+      test_const_correctness,
+      test_lazy_table,
+      test_cow_snapshot,
+      test_persistent_map,
+      test_diff,
+      test_nothrow_lookup,
+      test_cached_hash,
+      test_bulk_update,
+      test_merge,
+      test_numa_map,
+      test_hugepage_table,
+      test_find_many,
+      test_filtered_dictionary,
+      test_bounded_cache,
+      test_expiring_hash_map,
+      test_multi_dictionary,
+      test_large_capacity,
+      test_string_pool,
+      test_ordered_dictionary,
+      test_durable_dictionary,
+      test_serialization,
+      test_striped_hash_map,
+      test_counter_map,
+      test_buffered_dictionary,
+      test_parallel_constructor,
+      test_hash_batch
   };
 
   int i = 0, passed = 0, counter = 0;